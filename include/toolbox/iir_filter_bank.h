@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Multi-channel IIR filtering, for smoothing a whole frame of sensor values per tick instead of
+// looping over one iir_smoother per channel.
+//
+// All channels of a bank share the same cascade of sections, and the per-channel filter state is
+// kept in 32-byte aligned arrays (one row per state variable), so an update processes 8 channels
+// per AVX2 instruction, or 4 with SSE. The implementation is picked at run time from what the CPU
+// supports; a scalar path covers other architectures and the channels past the last full vector.
+//
+// Samples are floats: it doubles the channels per instruction compared to double, and sensor
+// values do not carry more precision than that.
+
+// Coefficients of one section of the cascade.
+struct IirSection {
+  enum Type { FIRST_ORDER, BIQUAD };
+
+  Type type = FIRST_ORDER;
+  // First order: y += b0 * (x - y), i.e. iir_smoother with alpha = b0.
+  // Biquad: y = b0 x + b1 x[-1] + b2 x[-2] - a1 y[-1] - a2 y[-2], with a0 normalized to 1.
+  float b0 = 1.0f;
+  float b1 = 0.0f;
+  float b2 = 0.0f;
+  float a1 = 0.0f;
+  float a2 = 0.0f;
+
+  static IirSection firstOrder(float alpha);
+  static IirSection biquad(float b0, float b1, float b2, float a1, float a2);
+  // Second-order low and high pass filters (RBJ audio EQ cookbook). The default q gives a
+  // Butterworth response.
+  static IirSection lowPass(double cutoff_hz, double sample_rate_hz, double q = 0.70710678118654752);
+  static IirSection highPass(double cutoff_hz, double sample_rate_hz, double q = 0.70710678118654752);
+
+  // Gain of the section for a constant input.
+  double dcGain() const;
+};
+
+class IirFilterBank {
+public:
+  enum Isa { ISA_SCALAR, ISA_SSE, ISA_AVX2 };
+
+  // First-order smoothing of every channel, same response as iir_smoother(0, alpha).
+  IirFilterBank(size_t num_channels, float alpha);
+  // Cascade of sections, applied in order.
+  IirFilterBank(size_t num_channels, std::vector<IirSection> sections);
+
+  IirFilterBank(IirFilterBank&&) noexcept = default;
+  IirFilterBank& operator=(IirFilterBank&&) noexcept = default;
+
+  // Filter one frame: in and out hold numChannels() values, and may be the same array.
+  void update(const float* in, float* out) noexcept;
+  void update(std::span<const float> in, std::span<float> out) noexcept;
+
+  // Set the state as if every channel had seen a constant input 'value' forever, so the filter
+  // starts settled (like the initial value of iir_smoother) instead of ramping up from zero.
+  void reset(float value = 0.0f) noexcept;
+  void reset(const float* values) noexcept;
+
+  size_t numChannels() const { return num_channels_; }
+  const std::vector<IirSection>& sections() const { return sections_; }
+
+  // Implementation in use. setIsa() is for testing and benchmarking; it never selects an
+  // instruction set that the CPU does not support.
+  Isa isa() const { return isa_; }
+  void setIsa(Isa isa);
+  static Isa bestIsa();
+
+private:
+  struct FreeDeleter {
+    void operator()(float* p) const { std::free(p); }
+  };
+
+  void resetChannel(size_t channel, float value) noexcept;
+
+  size_t num_channels_;
+  size_t stride_;  // num_channels_ rounded up to a full AVX2 vector
+  std::vector<IirSection> sections_;
+  std::vector<size_t> state_offset_;  // first state row of every section
+  std::unique_ptr<float[], FreeDeleter> state_;
+  Isa isa_;
+};
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cassert>
+#include <cmath>
+#include <span>
+
 /// simple infinte impulse response filter
 struct iir_smoother {
   double val_;
@@ -11,9 +15,91 @@ struct iir_smoother {
   }
 
   double update(double v) {
-    val_ = alpha_ * v + (1.0f - alpha_) * val_;
+    val_ = alpha_ * v + (1.0 - alpha_) * val_;
     return val_;
   }
 
   double operator()(double v) { return update(v); }
 };
+
+/// exponential smoother for irregularly sampled values: every sample is weighted by the time elapsed
+/// since the previous one, alpha = 1 - exp(-dt / time_constant). A burst of samples moves the value no
+/// more than one sample after the same gap would, and after a long gap the new sample dominates.
+struct timed_iir_smoother {
+  /// how alpha is computed from x = dt / time_constant
+  enum approximation {
+    EXP,       ///< 1 - exp(-x), exact
+    POLY,      ///< exp(-x) as (cubic Taylor of exp(-x/64))^64, no libm call; absolute error < 1e-6
+    RATIONAL,  ///< x / (1 + x), one division; slightly under-weights long gaps
+  };
+
+  double val_ = 0;
+  double last_time_ = 0;
+  double time_constant_;
+  approximation approx_;
+  bool initialized_ = false;
+
+  timed_iir_smoother(double time_constant, approximation approx = EXP)
+      : time_constant_(time_constant)
+      , approx_(approx) {
+    assert(time_constant > 0);
+  }
+
+  /// the first sample initializes the value; samples not newer than the previous one are ignored
+  double update(double v, double t) {
+    if (!initialized_) {
+      val_ = v;
+      last_time_ = t;
+      initialized_ = true;
+      return val_;
+    }
+    double dt = t - last_time_;
+    if (dt <= 0) return val_;
+    last_time_ = t;
+    val_ += alpha(dt) * (v - val_);
+    return val_;
+  }
+
+  double operator()(double v, double t) { return update(v, t); }
+
+  /// smooth a batch of (value, time) samples, returning the final value
+  double update(std::span<const double> values, std::span<const double> times) {
+    assert(values.size() == times.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      update(values[i], times[i]);
+    }
+    return val_;
+  }
+
+  /// same, also writing the smoothed value after every sample to out
+  double update(std::span<const double> values, std::span<const double> times, std::span<double> out) {
+    assert(values.size() == times.size() && out.size() >= values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      out[i] = update(values[i], times[i]);
+    }
+    return val_;
+  }
+
+  double alpha(double dt) const {
+    double x = dt / time_constant_;
+    switch (approx_) {
+      case POLY: {
+        // Beyond 16 time constants exp(-x) is below 1.2e-7
+        if (x >= 16.0) return 1.0;
+        double y = x * (1.0 / 64.0);
+        double e = 1.0 - y * (1.0 - y * (0.5 - y * (1.0 / 6.0)));
+        for (int i = 0; i < 6; i++) {
+          e *= e;
+        }
+        return 1.0 - e;
+      }
+      case RATIONAL:
+        return x / (1.0 + x);
+      case EXP:
+      default:
+        return -std::expm1(-x);
+    }
+  }
+
+  void reset() { initialized_ = false; }
+};
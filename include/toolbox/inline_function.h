@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, size_t InlineSize = 48>
+class InlineFunction;
+
+// Move-only replacement for std::function, storing the callable in an inline buffer of InlineSize
+// bytes. Callables that fit (e.g. a lambda capturing a few pointers) are never heap allocated, and
+// moving an InlineFunction moves the callable instead of copying it. Larger callables, and callables
+// that could throw when moved, fall back to a heap allocation.
+//
+// Unlike std::function, the callable does not need to be copyable, so lambdas can capture
+// std::unique_ptr, std::promise, etc.
+template <typename R, typename... Args, size_t InlineSize>
+class InlineFunction<R(Args...), InlineSize> {
+  static_assert(InlineSize >= sizeof(void*), "InlineFunction needs room for at least a pointer");
+
+  struct Ops {
+    R (*invoke)(void* storage, Args&&... args);
+    void (*move)(void* dst, void* src) noexcept;  // move-constructs dst from src, then destroys src
+    void (*destroy)(void* storage) noexcept;
+  };
+
+  template <typename F>
+  static constexpr bool kStoredInline = sizeof(F) <= InlineSize &&
+                                        alignof(F) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<F>;
+
+  template <typename F>
+  static constexpr Ops kInlineOps = {
+      [](void* s, Args&&... args) -> R { return std::invoke(*static_cast<F*>(s), std::forward<Args>(args)...); },
+      [](void* dst, void* src) noexcept {
+        ::new (dst) F(std::move(*static_cast<F*>(src)));
+        static_cast<F*>(src)->~F();
+      },
+      [](void* s) noexcept { static_cast<F*>(s)->~F(); },
+  };
+
+  template <typename F>
+  static constexpr Ops kHeapOps = {
+      [](void* s, Args&&... args) -> R { return std::invoke(**static_cast<F**>(s), std::forward<Args>(args)...); },
+      [](void* dst, void* src) noexcept { *static_cast<F**>(dst) = *static_cast<F**>(src); },
+      [](void* s) noexcept { delete *static_cast<F**>(s); },
+  };
+
+public:
+  InlineFunction() noexcept = default;
+  InlineFunction(std::nullptr_t) noexcept {}
+
+  template <typename F, typename D = std::decay_t<F>,
+            typename = std::enable_if_t<!std::is_same_v<D, InlineFunction> && std::is_invocable_r_v<R, D&, Args...>>>
+  InlineFunction(F&& f) {
+    if constexpr (kStoredInline<D>) {
+      ::new (static_cast<void*>(storage_)) D(std::forward<F>(f));
+      ops_ = &kInlineOps<D>;
+    } else {
+      *reinterpret_cast<D**>(storage_) = new D(std::forward<F>(f));
+      ops_ = &kHeapOps<D>;
+    }
+  }
+
+  InlineFunction(InlineFunction&& other) noexcept { moveFrom(other); }
+
+  InlineFunction& operator=(InlineFunction&& other) noexcept {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  InlineFunction(const InlineFunction&) = delete;
+  InlineFunction& operator=(const InlineFunction&) = delete;
+
+  ~InlineFunction() { reset(); }
+
+  R operator()(Args... args) { return ops_->invoke(storage_, std::forward<Args>(args)...); }
+
+  explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+  // Destroys the callable, releasing whatever it captured.
+  void reset() noexcept {
+    if (ops_) {
+      ops_->destroy(storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  // Whether a callable of type F is stored without a heap allocation.
+  template <typename F>
+  static constexpr bool storedInline() {
+    return kStoredInline<std::decay_t<F>>;
+  }
+
+private:
+  void moveFrom(InlineFunction& other) noexcept {
+    if (other.ops_) {
+      other.ops_->move(storage_, other.storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+  }
+
+  alignas(std::max_align_t) unsigned char storage_[InlineSize];
+  const Ops* ops_ = nullptr;
+};
@@ -0,0 +1,186 @@
+/**
+ * @file latency_histogram.h
+ * @brief HDR-style log-linear histogram with O(1) recording, and a recorder that keeps one histogram per
+ * thread so recording never takes a lock.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class LatencyHistogram
+ * @brief Log-linear bucketed histogram of unsigned integer values (e.g. nanoseconds).
+ *
+ * @note
+ * - Values below 2^sub_bucket_bits get their own bucket. Above that, every power of two is split into
+ *   2^(sub_bucket_bits-1) linear buckets, so the relative error of any reported value is at most
+ *   2^-(sub_bucket_bits-1) (0.8% for the default of 8 bits).
+ * - 'record' is O(1): a count-leading-zeros, a shift and a few relaxed stores. There is no allocation.
+ * - A histogram has a single writer (the thread calling 'record'), but can be read by snapshot() from any
+ *   thread at any time. Use LatencyRecorder to get one histogram per thread.
+ * - Values above the highest trackable value are counted in the last bucket; max() stays exact.
+ */
+class LatencyHistogram {
+public:
+  /**
+   * @brief A point-in-time copy of one or more histograms, for computing statistics.
+   */
+  class Snapshot {
+  public:
+    Snapshot() = default;
+
+    /**
+     * @brief Returns the value at quantile q (in [0, 1]); 0 if the snapshot is empty.
+     */
+    [[nodiscard]] uint64_t getPercentile(double q) const noexcept;
+    [[nodiscard]] uint64_t count() const noexcept { return count_; }
+    [[nodiscard]] uint64_t min() const noexcept { return count_ ? min_ : 0; }
+    [[nodiscard]] uint64_t max() const noexcept { return max_; }
+    [[nodiscard]] double mean() const noexcept { return count_ ? double(sum_) / double(count_) : 0.0; }
+    [[nodiscard]] uint64_t sum() const noexcept { return sum_; }
+    [[nodiscard]] bool empty() const noexcept { return count_ == 0; }
+
+    /**
+     * @brief Adds the contents of another snapshot. Both must come from histograms with the same layout.
+     * @return false if the layouts differ.
+     */
+    bool merge(const Snapshot& other);
+
+  private:
+    friend class LatencyHistogram;
+    int sub_bucket_bits_ = 0;
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+  };
+
+  /**
+   * @brief Constructor.
+   * @param highest_trackable Largest value that gets an accurate bucket (default: one hour in ns).
+   * @param sub_bucket_bits Precision, in bits; relative error is at most 2^-(sub_bucket_bits-1).
+   */
+  explicit LatencyHistogram(uint64_t highest_trackable = 3600ull * 1000000000ull, int sub_bucket_bits = 8);
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  /**
+   * @brief Records a value. Only one thread may record into a given histogram.
+   * @note Time complexity is O(1).
+   */
+  void record(uint64_t value, uint64_t n = 1) noexcept {
+    bump(counts_[bucketIndex(value)], n);
+    bump(count_, n);
+    bump(sum_, value * n);
+    if (value < min_.load(std::memory_order_relaxed)) min_.store(value, std::memory_order_relaxed);
+    if (value > max_.load(std::memory_order_relaxed)) max_.store(value, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Records a duration given in seconds, as nanoseconds.
+   */
+  void recordSeconds(double seconds) noexcept { record(seconds > 0 ? uint64_t(seconds * 1e9) : 0); }
+
+  /**
+   * @brief Copies the current contents. Safe to call while another thread records.
+   */
+  [[nodiscard]] Snapshot snapshot() const;
+
+  /**
+   * @brief Clears the histogram. Must be called from the recording thread, or while nobody records.
+   */
+  void reset() noexcept;
+
+  [[nodiscard]] uint64_t count() const noexcept { return count_.load(std::memory_order_relaxed); }
+  [[nodiscard]] size_t bucketCount() const noexcept { return num_buckets_; }
+  [[nodiscard]] int subBucketBits() const noexcept { return sub_bucket_bits_; }
+
+  /**
+   * @brief Returns the index of the bucket holding 'value'.
+   */
+  [[nodiscard]] size_t bucketIndex(uint64_t value) const noexcept {
+    if (value < sub_bucket_count_) return size_t(value);
+    int exponent = 64 - __builtin_clzll(value) - sub_bucket_bits_;
+    size_t index = sub_bucket_count_ + size_t(exponent - 1) * half_count_ +
+                   size_t((value >> exponent) - half_count_);
+    return index < num_buckets_ ? index : num_buckets_ - 1;
+  }
+
+  /**
+   * @brief Returns the lowest and highest values that map to bucket 'index'.
+   */
+  static uint64_t bucketLowest(size_t index, int sub_bucket_bits) noexcept;
+  static uint64_t bucketHighest(size_t index, int sub_bucket_bits) noexcept;
+
+private:
+  static void bump(std::atomic<uint64_t>& c, uint64_t n) noexcept {
+    // Single writer: a plain load/store pair is enough and avoids a locked instruction
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  int sub_bucket_bits_;
+  uint64_t sub_bucket_count_;
+  uint64_t half_count_;
+  size_t num_buckets_;
+  std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> min_{UINT64_MAX};
+  std::atomic<uint64_t> max_{0};
+};
+
+/**
+ * @class LatencyRecorder
+ * @brief Hands every recording thread its own LatencyHistogram, and merges them on demand.
+ *
+ * @note Recording takes no lock: after the first record() from a thread, finding that thread's histogram
+ * is a thread-local lookup, a direct-mapped cache of 4 recorders then a binary search over every recorder
+ * the thread has used (16 bytes each, kept for the thread's lifetime). Histograms are owned by the
+ * recorder and live until it is destroyed, so samples from threads that already exited are still part
+ * of the snapshot.
+ */
+class LatencyRecorder {
+public:
+  explicit LatencyRecorder(uint64_t highest_trackable = 3600ull * 1000000000ull, int sub_bucket_bits = 8);
+  ~LatencyRecorder();
+
+  LatencyRecorder(const LatencyRecorder&) = delete;
+  LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+  /**
+   * @brief Records a value into the calling thread's histogram.
+   */
+  void record(uint64_t value, uint64_t n = 1) noexcept { local().record(value, n); }
+  void recordSeconds(double seconds) noexcept { local().recordSeconds(seconds); }
+
+  /**
+   * @brief Returns the calling thread's histogram, creating it on first use.
+   */
+  LatencyHistogram& local();
+
+  /**
+   * @brief Merges the histograms of all threads.
+   */
+  [[nodiscard]] LatencyHistogram::Snapshot snapshot() const;
+
+  /**
+   * @brief Clears all histograms. Only safe while no thread is recording.
+   */
+  void reset();
+
+private:
+  LatencyHistogram& localSlow();
+
+  const uint64_t id_;  ///< Unique id, never reused, for the thread-local cache
+  const uint64_t highest_trackable_;
+  const int sub_bucket_bits_;
+  mutable std::mutex mutex_;
+  std::vector<std::pair<std::thread::id, std::unique_ptr<LatencyHistogram>>> histograms_;
+};
@@ -0,0 +1,208 @@
+/**
+ * @file p2_percentile.h
+ * @brief Constant-memory running percentile estimation with the P-square algorithm.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+
+/**
+ * @class P2Quantile
+ * @brief Estimates a single quantile of a stream with five markers (Jain & Chlamtac, CACM 1985).
+ *
+ * @note
+ * - Memory is five heights and five positions, independently of the number of samples.
+ * - 'add' is O(1): it moves the markers towards their desired positions with a piecewise-parabolic
+ *   (or, if that would break monotonicity, linear) prediction of the quantile function.
+ * - The estimate is exact for the first five samples; afterwards it converges on the true quantile for
+ *   stationary streams. It summarizes the whole stream since the last reset(), not a window.
+ */
+class P2Quantile {
+public:
+  explicit P2Quantile(double percentile = 0.95)
+      : p_(percentile) {
+    assert(percentile >= 0.0 && percentile <= 1.0);
+    reset();
+  }
+
+  /**
+   * @brief Adds a new sample.
+   * @note Time complexity is O(1).
+   */
+  void add(double x) noexcept {
+    if (count_ < 5) {
+      // Keep the first samples sorted; they are the initial marker heights
+      size_t i = count_++;
+      while (i > 0 && q_[i - 1] > x) {
+        q_[i] = q_[i - 1];
+        --i;
+      }
+      q_[i] = x;
+      return;
+    }
+    count_++;
+
+    // Find the cell k containing x, extending the extremes if necessary
+    int k;
+    if (x < q_[0]) {
+      q_[0] = x;
+      k = 0;
+    } else if (x >= q_[4]) {
+      q_[4] = x;
+      k = 3;
+    } else {
+      k = 0;
+      while (k < 3 && x >= q_[k + 1]) ++k;
+    }
+
+    for (int i = k + 1; i < 5; i++) n_[i] += 1.0;
+    for (int i = 0; i < 5; i++) desired_[i] += increment_[i];
+
+    // Adjust the heights of the three middle markers
+    for (int i = 1; i < 4; i++) {
+      double d = desired_[i] - n_[i];
+      if ((d >= 1.0 && n_[i + 1] - n_[i] > 1.0) || (d <= -1.0 && n_[i - 1] - n_[i] < -1.0)) {
+        double s = d >= 0.0 ? 1.0 : -1.0;
+        double qp = parabolic(i, s);
+        if (q_[i - 1] < qp && qp < q_[i + 1]) {
+          q_[i] = qp;
+        } else {
+          q_[i] = linear(i, s);
+        }
+        n_[i] += s;
+      }
+    }
+  }
+
+  /**
+   * @brief Returns the current estimate of the quantile; 0 if no sample was added.
+   */
+  [[nodiscard]] double getPercentile() const noexcept {
+    if (count_ == 0) return 0.0;
+    if (count_ <= 5) return q_[size_t(p_ * double(count_ - 1))];
+    return q_[2];
+  }
+
+  [[nodiscard]] double getPercentileParameter() const noexcept { return p_; }
+
+  /**
+   * @brief Changes the target quantile. The markers cannot be re-targeted, so this restarts the estimate.
+   */
+  void setPercentileParameter(double value) noexcept {
+    assert(value >= 0.0 && value <= 1.0);
+    if (value == p_) return;
+    p_ = value;
+    reset();
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return count_; }
+  [[nodiscard]] bool empty() const noexcept { return count_ == 0; }
+
+  void reset() noexcept {
+    count_ = 0;
+    for (int i = 0; i < 5; i++) {
+      q_[i] = 0.0;
+      n_[i] = double(i);
+    }
+    desired_[0] = 0.0;
+    desired_[1] = 2.0 * p_;
+    desired_[2] = 4.0 * p_;
+    desired_[3] = 2.0 + 2.0 * p_;
+    desired_[4] = 4.0;
+    increment_[0] = 0.0;
+    increment_[1] = p_ / 2.0;
+    increment_[2] = p_;
+    increment_[3] = (1.0 + p_) / 2.0;
+    increment_[4] = 1.0;
+  }
+
+private:
+  double parabolic(int i, double d) const noexcept {
+    return q_[i] + d / (n_[i + 1] - n_[i - 1]) *
+                       ((n_[i] - n_[i - 1] + d) * (q_[i + 1] - q_[i]) / (n_[i + 1] - n_[i]) +
+                        (n_[i + 1] - n_[i] - d) * (q_[i] - q_[i - 1]) / (n_[i] - n_[i - 1]));
+  }
+
+  double linear(int i, double d) const noexcept {
+    int j = i + int(d);
+    return q_[i] + d * (q_[j] - q_[i]) / (n_[j] - n_[i]);
+  }
+
+  double p_;
+  size_t count_ = 0;
+  double q_[5];          ///< Marker heights
+  double n_[5];          ///< Marker positions
+  double desired_[5];    ///< Desired marker positions
+  double increment_[5];  ///< Increments of the desired positions per sample
+};
+
+/**
+ * @class P2Percentile
+ * @brief Running estimate of one or more percentiles of a stream, in constant memory.
+ *
+ * @note Drop-in replacement for PercentileBuffer when no window can be stored: same add/getPercentile
+ * interface, O(1) update, but the estimate covers the whole stream since the last reset(). Every target
+ * percentile costs one P2Quantile (ten doubles).
+ */
+class P2Percentile {
+public:
+  /**
+   * @brief Constructor for a single target percentile.
+   */
+  explicit P2Percentile(double percentile = 0.95)
+      : estimators_{P2Quantile(percentile)} {}
+
+  /**
+   * @brief Constructor for several target percentiles; the first one is returned by getPercentile().
+   */
+  P2Percentile(std::initializer_list<double> percentiles) {
+    assert(percentiles.size() > 0);
+    estimators_.reserve(percentiles.size());
+    for (double p : percentiles) estimators_.emplace_back(p);
+  }
+
+  /**
+   * @brief Adds a new sample to all the estimators.
+   * @note Time complexity is O(number of target percentiles).
+   */
+  void add(double value) noexcept {
+    for (auto& e : estimators_) e.add(value);
+  }
+
+  /**
+   * @brief Returns the estimate of the first target percentile.
+   */
+  [[nodiscard]] double getPercentile() const noexcept { return estimators_[0].getPercentile(); }
+
+  /**
+   * @brief Returns the estimate of the target percentile at 'index' (in constructor order).
+   */
+  [[nodiscard]] double getPercentileAt(size_t index) const noexcept {
+    assert(index < estimators_.size());
+    return estimators_[index].getPercentile();
+  }
+
+  [[nodiscard]] size_t numPercentiles() const noexcept { return estimators_.size(); }
+  [[nodiscard]] double getPercentileParameter() const noexcept {
+    return estimators_[0].getPercentileParameter();
+  }
+
+  /**
+   * @brief Changes the first target percentile, restarting its estimate.
+   */
+  void setPercentileParameter(double value) noexcept { estimators_[0].setPercentileParameter(value); }
+
+  [[nodiscard]] size_t size() const noexcept { return estimators_[0].size(); }
+  [[nodiscard]] bool empty() const noexcept { return estimators_[0].empty(); }
+
+  void reset() noexcept {
+    for (auto& e : estimators_) e.reset();
+  }
+
+private:
+  std::vector<P2Quantile> estimators_;
+};
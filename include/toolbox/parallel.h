@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "threadpool.h"
+
+// Data-parallel algorithms on a ThreadPool, the shared pool by default:
+//
+//   ParallelFor(0, n, 0, [&](size_t i) { out[i] = Process(in[i]); });
+//   double sum = ParallelReduce(0, n, 0, 0.0, [&](size_t b, size_t e, double acc) {
+//     for (; b < e; b++) acc += v[b];
+//     return acc;
+//   }, std::plus<double>());
+//   ParallelSort(items.begin(), items.end());
+//
+// The index type is the type of 'end', so 'begin' may be a plain 0 whatever the type of n. The
+// range is cut into chunks of 'nGrain' indexes (0 picks about 8 chunks per pool thread). The
+// calling thread runs chunks too, and only waits for the chunks other threads are running, so the
+// algorithms can be nested, and called from a pool worker. The first exception thrown by a chunk
+// stops the remaining chunks and is rethrown to the caller.
+
+namespace parallel_detail {
+
+struct ChunkState {
+  size_t nChunks = 0;
+  std::atomic<size_t> nNext{0};
+  std::atomic<size_t> nDone{0};
+  std::atomic_bool bFailed{false};
+  std::mutex mutex;
+  std::exception_ptr exception;
+};
+
+template <typename ChunkFunction>
+void RunChunksOn(ChunkState& state, ChunkFunction& chunk) {
+  for (;;) {
+    const size_t k = state.nNext.fetch_add(1, std::memory_order_relaxed);
+    if (k >= state.nChunks) return;
+    if (!state.bFailed.load(std::memory_order_relaxed)) {
+      try {
+        chunk(k);
+      } catch (...) {
+        std::lock_guard lock(state.mutex);
+        if (!state.exception) state.exception = std::current_exception();
+        state.bFailed = true;
+      }
+    }
+    if (state.nDone.fetch_add(1, std::memory_order_acq_rel) + 1 == state.nChunks) state.nDone.notify_all();
+  }
+}
+
+// Run chunk(k) for every k in [0, nChunks), on the pool and the calling thread.
+template <typename ChunkFunction>
+void RunChunks(ThreadPool& pool, size_t nChunks, ChunkFunction& chunk) {
+  if (nChunks == 0) return;
+  if (nChunks == 1) {
+    chunk(0);
+    return;
+  }
+  // Helpers may start after the last chunk is done: they share the state, and only touch 'chunk'
+  // for a chunk they claimed, which the caller waits for.
+  auto state = std::make_shared<ChunkState>();
+  state->nChunks = nChunks;
+  const size_t nHelpers = std::min(nChunks - 1, pool.GetThreadCount());
+  for (size_t i = 0; i < nHelpers; i++) {
+    pool.PushFunc([state, pChunk = &chunk]() { RunChunksOn(*state, *pChunk); });
+  }
+  RunChunksOn(*state, chunk);
+  for (size_t nDone = state->nDone.load(std::memory_order_acquire); nDone < nChunks;
+       nDone = state->nDone.load(std::memory_order_acquire)) {
+    state->nDone.wait(nDone, std::memory_order_acquire);
+  }
+  if (state->exception) std::rethrow_exception(state->exception);
+}
+
+inline size_t ChunkSize(size_t n, size_t nGrain, const ThreadPool& pool) {
+  if (nGrain > 0) return nGrain;
+  return std::max<size_t>(1, n / (pool.GetThreadCount() * 8));
+}
+
+}  // namespace parallel_detail
+
+// Call fn(chunkBegin, chunkEnd) for consecutive chunks covering [begin, end).
+template <typename IndexType, typename FunctionType>
+void ParallelForRange(std::type_identity_t<IndexType> begin, IndexType end, size_t nGrain, FunctionType&& fn,
+                      ThreadPool& pool = ThreadPool::GetShared()) {
+  static_assert(std::is_integral_v<IndexType>, "ParallelForRange takes integer indexes");
+  if (end <= begin) return;
+  const size_t n = size_t(end - begin);
+  const size_t nChunk = parallel_detail::ChunkSize(n, nGrain, pool);
+  const size_t nChunks = (n + nChunk - 1) / nChunk;
+  auto chunk = [&](size_t k) {
+    const IndexType chunkBegin = IndexType(begin + IndexType(k * nChunk));
+    const IndexType chunkEnd = k + 1 == nChunks ? end : IndexType(chunkBegin + IndexType(nChunk));
+    fn(chunkBegin, chunkEnd);
+  };
+  parallel_detail::RunChunks(pool, nChunks, chunk);
+}
+
+// Call fn(i) for every i in [begin, end).
+template <typename IndexType, typename FunctionType>
+void ParallelFor(std::type_identity_t<IndexType> begin, IndexType end, size_t nGrain, FunctionType&& fn,
+                 ThreadPool& pool = ThreadPool::GetShared()) {
+  ParallelForRange(
+      begin, end, nGrain,
+      [&fn](IndexType chunkBegin, IndexType chunkEnd) {
+        for (IndexType i = chunkBegin; i < chunkEnd; i++) fn(i);
+      },
+      pool);
+}
+
+// Fold every chunk with map(chunkBegin, chunkEnd, identity) -> T, then combine the chunk results
+// with reduce(T, T) -> T, in index order: the result does not depend on the number of threads, for
+// a given grain.
+template <typename IndexType, typename T, typename MapFunction, typename ReduceFunction>
+T ParallelReduce(std::type_identity_t<IndexType> begin, IndexType end, size_t nGrain, T identity,
+                 MapFunction&& map, ReduceFunction&& reduce, ThreadPool& pool = ThreadPool::GetShared()) {
+  static_assert(std::is_integral_v<IndexType>, "ParallelReduce takes integer indexes");
+  if (end <= begin) return identity;
+  const size_t n = size_t(end - begin);
+  const size_t nChunk = parallel_detail::ChunkSize(n, nGrain, pool);
+  const size_t nChunks = (n + nChunk - 1) / nChunk;
+  std::vector<T> partials(nChunks, identity);
+  auto chunk = [&](size_t k) {
+    const IndexType chunkBegin = IndexType(begin + IndexType(k * nChunk));
+    const IndexType chunkEnd = k + 1 == nChunks ? end : IndexType(chunkBegin + IndexType(nChunk));
+    partials[k] = map(chunkBegin, chunkEnd, identity);
+  };
+  parallel_detail::RunChunks(pool, nChunks, chunk);
+  T result = std::move(identity);
+  for (T& partial : partials) result = reduce(std::move(result), std::move(partial));
+  return result;
+}
+
+// out[i] = fn(first[i]) for every element of [first, last). Random access iterators; returns the
+// end of the output.
+template <typename InputIterator, typename OutputIterator, typename FunctionType>
+OutputIterator ParallelTransform(InputIterator first, InputIterator last, OutputIterator out,
+                                 FunctionType&& fn, size_t nGrain = 0,
+                                 ThreadPool& pool = ThreadPool::GetShared()) {
+  const ptrdiff_t n = std::distance(first, last);
+  ParallelForRange(
+      ptrdiff_t(0), n, nGrain,
+      [&](ptrdiff_t chunkBegin, ptrdiff_t chunkEnd) {
+        std::transform(first + chunkBegin, first + chunkEnd, out + chunkBegin, fn);
+      },
+      pool);
+  return out + n;
+}
+
+namespace parallel_detail {
+
+// Number of elements of a that come first when stably merging a and b, up to output position d
+// (merge path).
+template <typename Iterator, typename Compare>
+size_t MergeSplit(Iterator a, size_t nA, Iterator b, size_t nB, size_t d, Compare& comp) {
+  size_t lo = d > nB ? d - nB : 0;
+  size_t hi = std::min(d, nA);
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    const size_t j = d - mid;
+    // a[mid] is among the first d unless b[j - 1] < a[mid]
+    if (j > 0 && !comp(b[j - 1], a[mid])) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+}  // namespace parallel_detail
+
+// Stable merge sort: runs sorted in parallel, then merged pairwise, each merge split across the
+// pool. Needs elements that are movable and default constructible, and n extra elements of memory.
+template <typename Iterator, typename Compare = std::less<>>
+void ParallelSort(Iterator first, Iterator last, Compare comp = Compare(),
+                  ThreadPool& pool = ThreadPool::GetShared()) {
+  typedef typename std::iterator_traits<Iterator>::value_type VALUE;
+  static constexpr size_t kMinRun = 4096;
+  const size_t n = size_t(std::distance(first, last));
+  size_t nRuns = 1;
+  while (nRuns < pool.GetThreadCount() * 2 && n / (nRuns * 2) >= kMinRun) nRuns *= 2;
+  if (nRuns == 1) {
+    std::stable_sort(first, last, comp);
+    return;
+  }
+
+  // Sort the runs
+  const size_t nRun = (n + nRuns - 1) / nRuns;
+  ParallelFor(size_t(0), nRuns, 1, [&](size_t r) {
+    const size_t nBegin = std::min(n, r * nRun);
+    std::stable_sort(first + nBegin, first + std::min(n, nBegin + nRun), comp);
+  }, pool);
+
+  // Merge pairs of runs, back and forth between the input and the buffer
+  std::vector<VALUE> buffer(n);
+  bool bInBuffer = false;
+  const size_t nParts = pool.GetThreadCount() * 2;
+  for (size_t nWidth = nRun; nWidth < n; nWidth *= 2) {
+    auto merge = [&](auto source, auto target) {
+      const size_t nPairs = (n + 2 * nWidth - 1) / (2 * nWidth);
+      // Every merge of a pair is split into nParts pieces of output
+      ParallelFor(size_t(0), nPairs * nParts, 1, [&](size_t k) {
+        const size_t nPairBegin = (k / nParts) * 2 * nWidth;
+        const size_t nPart = k % nParts;
+        const size_t nA = std::min(nWidth, n - nPairBegin);
+        const size_t nB = std::min(nWidth, n - nPairBegin - nA);
+        const auto a = source + nPairBegin;
+        const auto b = a + nA;
+        const size_t dBegin = (nA + nB) * nPart / nParts;
+        const size_t dEnd = (nA + nB) * (nPart + 1) / nParts;
+        const size_t iBegin = parallel_detail::MergeSplit(a, nA, b, nB, dBegin, comp);
+        const size_t iEnd = parallel_detail::MergeSplit(a, nA, b, nB, dEnd, comp);
+        std::merge(std::make_move_iterator(a + iBegin), std::make_move_iterator(a + iEnd),
+                   std::make_move_iterator(b + (dBegin - iBegin)), std::make_move_iterator(b + (dEnd - iEnd)),
+                   target + nPairBegin + dBegin, comp);
+      }, pool);
+    };
+    if (bInBuffer) {
+      merge(buffer.begin(), first);
+    } else {
+      merge(first, buffer.begin());
+    }
+    bInBuffer = !bInBuffer;
+  }
+  if (bInBuffer) {
+    ParallelTransform(
+        buffer.begin(), buffer.end(), first, [](VALUE& v) { return std::move(v); }, kMinRun, pool);
+  }
+}
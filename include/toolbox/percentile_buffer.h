@@ -8,8 +8,111 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <type_traits>
+
+namespace percentile_buffer_detail {
+
+/**
+ * @brief Fixed-capacity pool of equally sized nodes, carved out of one slab on first use.
+ * @note Requests that do not fit (wrong size, or pool exhausted) fall back to the global heap.
+ */
+class NodePool {
+public:
+  explicit NodePool(size_t capacity)
+      : capacity_(capacity) {}
+
+  NodePool(const NodePool&) = delete;
+  NodePool& operator=(const NodePool&) = delete;
+
+  void* allocate(size_t bytes) {
+    if (!slab_) {
+      node_size_ = roundUp(std::max(bytes, sizeof(FreeNode)));
+      slab_.reset(new std::byte[node_size_ * capacity_]);
+    }
+    if (bytes <= node_size_) {
+      if (free_list_) {
+        FreeNode* n = free_list_;
+        free_list_ = n->next;
+        return n;
+      }
+      if (used_ < capacity_) {
+        return slab_.get() + node_size_ * used_++;
+      }
+    }
+    return ::operator new(bytes);
+  }
+
+  void deallocate(void* p) noexcept {
+    std::byte* b = static_cast<std::byte*>(p);
+    if (slab_ && b >= slab_.get() && b < slab_.get() + node_size_ * capacity_) {
+      FreeNode* n = static_cast<FreeNode*>(p);
+      n->next = free_list_;
+      free_list_ = n;
+    } else {
+      ::operator delete(p);
+    }
+  }
+
+private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  static size_t roundUp(size_t bytes) {
+    constexpr size_t align = alignof(std::max_align_t);
+    return (bytes + align - 1) / align * align;
+  }
+
+  size_t capacity_;
+  size_t node_size_ = 0;
+  size_t used_ = 0;  ///< Nodes of the slab handed out at least once
+  std::unique_ptr<std::byte[]> slab_;
+  FreeNode* free_list_ = nullptr;
+};
+
+/**
+ * @brief Allocator handing out single nodes from a NodePool. A null pool means the global heap.
+ */
+template <typename U>
+struct PoolAllocator {
+  using value_type = U;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  static_assert(alignof(U) <= alignof(std::max_align_t), "PoolAllocator does not support over-aligned types");
+
+  NodePool* pool;
+
+  explicit PoolAllocator(NodePool* p) noexcept
+      : pool(p) {}
+  template <typename V>
+  PoolAllocator(const PoolAllocator<V>& other) noexcept
+      : pool(other.pool) {}
+
+  U* allocate(size_t n) {
+    if (n == 1 && pool) return static_cast<U*>(pool->allocate(sizeof(U)));
+    return static_cast<U*>(::operator new(n * sizeof(U)));
+  }
+
+  void deallocate(U* p, size_t n) noexcept {
+    if (n == 1 && pool) {
+      pool->deallocate(p);
+    } else {
+      ::operator delete(p);
+    }
+  }
+
+  template <typename V>
+  bool operator==(const PoolAllocator<V>& other) const noexcept {
+    return pool == other.pool;
+  }
+};
+
+}  // namespace percentile_buffer_detail
 
 /**
  * @class PercentileBuffer
@@ -30,14 +133,37 @@
  * @note The buffer is implemented using two multimaps, one for the left half of the buffer and one for the
  * right half. The left half is sorted in descending order and the right half is sorted in ascending order.
  * This allows for efficient access to the specified percentile element.
+ *
+ * @note The multimap nodes come from a pool sized from max_size, allocated once on the first 'add'.
+ * Once the buffer is full, the evicted node is reused for the new element, and rebalancing moves nodes
+ * between the halves with extract/insert, so the steady state does no heap allocation per sample.
  */
 template <typename T>
 class PercentileBuffer {
+public:
+  using allocator_type = percentile_buffer_detail::PoolAllocator<std::pair<const T, int>>;
+  using map_type = std::multimap<T, int, std::less<T>, allocator_type>;
+  using iterator = typename map_type::iterator;
+  using const_iterator = typename map_type::const_iterator;
+
 private:
-  std::multimap<T, int> left, right;  ///< Multimaps to store the elements.
-  size_t sequence;                    ///< Sequence number for the next element to be added.
-  size_t max_size;                    ///< Maximum size of the buffer.
-  double percentile;                  ///< The percentile to be calculated. Defaults to 0.95.
+  std::unique_ptr<percentile_buffer_detail::NodePool> pool;  ///< Node storage shared by both halves.
+  map_type left, right;                                      ///< Multimaps to store the elements.
+  size_t sequence;    ///< Sequence number for the next element to be added.
+  size_t max_size;    ///< Maximum size of the buffer.
+  double percentile;  ///< The percentile to be calculated. Defaults to 0.95.
+
+  /**
+   * @brief Moves nodes between the halves until the left one holds the requested percentile.
+   */
+  void rebalance() noexcept {
+    while (left.size() < size() * percentile) {
+      left.insert(right.extract(right.begin()));
+    }
+    while (!left.empty() && left.size() > size() * percentile) {
+      right.insert(left.extract(--left.end()));  // safe to use --end() as left is not empty
+    }
+  }
 
 public:
   /**
@@ -46,13 +172,60 @@ public:
    * @param percentile The percentile to be calculated.
    */
   PercentileBuffer(size_t max_size, double percentile = 0.95)
-      : sequence(0)
+      : pool(std::make_unique<percentile_buffer_detail::NodePool>(max_size))
+      , left(allocator_type(pool.get()))
+      , right(allocator_type(pool.get()))
+      , sequence(0)
       , max_size(max_size)
       , percentile(percentile) {
     assert(max_size > 0);
     assert(percentile >= 0.0 && percentile <= 1.0);
   }
 
+  PercentileBuffer(const PercentileBuffer& other)
+      : pool(std::make_unique<percentile_buffer_detail::NodePool>(other.max_size))
+      , left(other.left, allocator_type(pool.get()))
+      , right(other.right, allocator_type(pool.get()))
+      , sequence(other.sequence)
+      , max_size(other.max_size)
+      , percentile(other.percentile) {}
+
+  PercentileBuffer(PercentileBuffer&& other) noexcept
+      : pool(std::move(other.pool))
+      , left(std::move(other.left))
+      , right(std::move(other.right))
+      , sequence(other.sequence)
+      , max_size(other.max_size)
+      , percentile(other.percentile) {
+    // The moved-from buffer no longer owns a pool; let it use the heap
+    other.left = map_type(allocator_type(nullptr));
+    other.right = map_type(allocator_type(nullptr));
+  }
+
+  PercentileBuffer& operator=(const PercentileBuffer& other) {
+    if (this != &other) {
+      *this = PercentileBuffer(other);
+    }
+    return *this;
+  }
+
+  PercentileBuffer& operator=(PercentileBuffer&& other) noexcept {
+    if (this != &other) {
+      // Return our nodes to our pool before it is released
+      left.clear();
+      right.clear();
+      left = std::move(other.left);
+      right = std::move(other.right);
+      pool = std::move(other.pool);
+      sequence = other.sequence;
+      max_size = other.max_size;
+      percentile = other.percentile;
+      other.left = map_type(allocator_type(nullptr));
+      other.right = map_type(allocator_type(nullptr));
+    }
+    return *this;
+  }
+
   /**
    * @brief Adds a new element to the buffer.
    * @param value The value of the new element.
@@ -61,15 +234,21 @@ public:
   void add(const T& value) noexcept {
     // Check if buffer is full before adding new element
     if (full()) {
-      // Remove the oldest element
-      if (left.begin()->first < right.begin()->first) {
-        left.erase(left.begin());
+      // Remove the oldest element, and reuse its node for the new one
+      typename map_type::node_type node;
+      if (right.empty() || (!left.empty() && left.begin()->first < right.begin()->first)) {
+        node = left.extract(left.begin());
       } else {
-        right.erase(right.begin());
+        node = right.extract(right.begin());
       }
-    }
-
-    if (right.empty()) {
+      node.key() = value;
+      node.mapped() = int(sequence++);
+      if (right.empty() || value < right.begin()->first) {
+        left.insert(std::move(node));
+      } else {
+        right.insert(std::move(node));
+      }
+    } else if (right.empty()) {
       left.insert({value, sequence++});
     } else if (value < right.begin()->first) {
       left.insert({value, sequence++});
@@ -78,16 +257,7 @@ public:
     }
 
     // Rebalance if necessary
-    while (left.size() < size() * percentile) {
-      auto it = right.begin();
-      left.insert({it->first, it->second});
-      right.erase(it);
-    }
-    while (!left.empty() && left.size() > size() * percentile) {
-      auto it = --left.end();  // safe to use --end() as left is not empty
-      right.insert({it->first, it->second});
-      left.erase(it);
-    }
+    rebalance();
   }
 
   /**
@@ -206,16 +376,7 @@ public:
     percentile = value;
 
     // Rebalance if necessary
-    while (left.size() < size() * percentile) {
-      auto it = right.begin();
-      left.insert({it->first, it->second});
-      right.erase(it);
-    }
-    while (!left.empty() && left.size() > size() * percentile) {
-      auto it = --left.end();  // safe to use --end() as left is not empty
-      right.insert({it->first, it->second});
-      left.erase(it);
-    }
+    rebalance();
   }
 
   // iterators
@@ -224,25 +385,25 @@ public:
    * @brief Returns an iterator to the beginning of the buffer.
    * @return An iterator to the beginning of the buffer.
    */
-  typename std::multimap<T, int>::iterator begin() noexcept { return left.begin(); }
+  iterator begin() noexcept { return left.begin(); }
 
   /**
    * @brief Returns a const iterator to the beginning of the buffer.
    * @return A const iterator to the beginning of the buffer.
    */
-  typename std::multimap<T, int>::const_iterator begin() const noexcept { return left.begin(); }
+  const_iterator begin() const noexcept { return left.begin(); }
 
   /**
    * @brief Returns an iterator to the end of the buffer.
    * @return An iterator to the end of the buffer.
    */
-  typename std::multimap<T, int>::iterator end() noexcept { return right.end(); }
+  iterator end() noexcept { return right.end(); }
 
   /**
    * @brief Returns a const iterator to the end of the buffer.
    * @return A const iterator to the end of the buffer.
    */
-  typename std::multimap<T, int>::const_iterator end() const noexcept { return right.end(); }
+  const_iterator end() const noexcept { return right.end(); }
 
   /**
    * @brief Advances an iterator by n positions.
@@ -250,7 +411,7 @@ public:
    * @param n The number of positions to advance.
    * @note Time complexity is O(N) for large jumps. O(1) for increment by 1
    */
-  void advance(typename std::multimap<T, int>::iterator& it, int n) noexcept {
+  void advance(iterator& it, int n) noexcept {
     while (n > 0) {
       ++it;
       if (it == left.end()) {
@@ -273,7 +434,7 @@ public:
    * @param n The number of positions to advance.
    * @note Time complexity is O(N) for large jumps. O(1) for increment by 1
    */
-  void advance(typename std::multimap<T, int>::const_iterator& it, int n) const noexcept {
+  void advance(const_iterator& it, int n) const noexcept {
     while (n > 0) {
       ++it;
       if (it == left.cend()) {
@@ -295,26 +456,26 @@ public:
    * @param it The iterator to increment.
    * @note Time complexity is O(1)
    */
-  void next(typename std::multimap<T, int>::iterator& it) noexcept { advance(it, 1); }
+  void next(iterator& it) noexcept { advance(it, 1); }
 
   /**
    * @brief A convienience function to advance a const iterator by one position.
    * @param it The iterator to increment.
    * @note Time complexity is O(1)
    */
-  void next(typename std::multimap<T, int>::const_iterator& it) const noexcept { advance(it, 1); }
+  void next(const_iterator& it) const noexcept { advance(it, 1); }
 
   /**
    * @brief A convienience function to decrement an iterator by one position.
    * @param it The iterator to decrement.
    * @note Time complexity is O(1)
    */
-  void previous(typename std::multimap<T, int>::iterator& it) noexcept { advance(it, -1); }
+  void previous(iterator& it) noexcept { advance(it, -1); }
 
   /**
    * @brief A convienience function to decrement a const iterator by one position.
    * @param it The iterator to decrement.
    * @note Time complexity is O(1)
    */
-  void previous(typename std::multimap<T, int>::const_iterator& it) const noexcept { advance(it, -1); }
+  void previous(const_iterator& it) const noexcept { advance(it, -1); }
 };
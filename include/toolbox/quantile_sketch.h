@@ -0,0 +1,592 @@
+/**
+ * @file quantile_sketch.h
+ * @brief Bounded-memory, mergeable quantile sketches (DDSketch and KLL) sharing the PercentileBuffer
+ * interface.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "toolbox/percentile_buffer.h"
+
+/**
+ * @brief Interface shared by PercentileBuffer and the sketches below, so code computing a running
+ * percentile can be written against any of them.
+ */
+template <typename E>
+concept PercentileEstimator = requires(E e, const E& ce, double v) {
+  e.add(v);
+  ce.getPercentile();
+  { ce.size() } -> std::convertible_to<size_t>;
+  { ce.empty() } -> std::convertible_to<bool>;
+  { ce.getPercentileParameter() } -> std::convertible_to<double>;
+  e.setPercentileParameter(v);
+  e.reset();
+};
+
+/**
+ * @brief A PercentileEstimator whose instances can be combined (e.g. one per worker thread) and shipped
+ * across process boundaries.
+ */
+template <typename E>
+concept MergeablePercentileEstimator = PercentileEstimator<E> && requires(E e, const E& ce) {
+  { e.merge(ce) } -> std::convertible_to<bool>;
+  { ce.serialize() } -> std::convertible_to<std::vector<uint8_t>>;
+};
+
+namespace quantile_sketch_detail {
+
+// Serialization helpers. Values are stored in host byte order.
+template <typename V>
+inline void put(std::vector<uint8_t>& out, const V& v) {
+  static_assert(std::is_trivially_copyable_v<V>);
+  size_t pos = out.size();
+  out.resize(pos + sizeof(V));
+  memcpy(out.data() + pos, &v, sizeof(V));
+}
+
+template <typename V>
+inline bool get(const uint8_t*& data, const uint8_t* end, V& v) {
+  static_assert(std::is_trivially_copyable_v<V>);
+  if (size_t(end - data) < sizeof(V)) return false;
+  memcpy(&v, data, sizeof(V));
+  data += sizeof(V);
+  return true;
+}
+
+}  // namespace quantile_sketch_detail
+
+/**
+ * @class DDSketch
+ * @brief Quantile sketch with a relative-error guarantee (Masson, Rim & Lee, VLDB 2019).
+ *
+ * @note
+ * - Every returned quantile q' of a true quantile q satisfies |q' - q| <= alpha * |q|, where alpha is the
+ *   relative accuracy given in the constructor. This is a good fit for latencies and sizes, which span
+ *   many orders of magnitude.
+ * - Values are mapped to logarithmically sized buckets. 'add' is O(1) (amortized), 'getPercentile' is
+ *   O(number of buckets).
+ * - Memory is bounded by max_num_buckets per sign. When the range of keys exceeds it, the lowest
+ *   buckets are collapsed together, which only affects the accuracy of the smallest magnitudes.
+ * - Keys are kept within +-2^30: infinities, and magnitudes past that range at very fine accuracies,
+ *   are counted in the highest bucket, without the accuracy guarantee.
+ * - Unlike PercentileBuffer, a sketch summarizes the whole stream since the last reset(), not a sliding
+ *   window. Use one sketch per reporting period and merge() them as required.
+ */
+class DDSketch {
+public:
+  /**
+   * @brief Constructor.
+   * @param relative_accuracy Relative error guarantee, in (0, 1).
+   * @param percentile The percentile returned by getPercentile().
+   * @param max_num_buckets Maximum number of buckets per sign (bounds memory).
+   */
+  explicit DDSketch(double relative_accuracy = 0.01, double percentile = 0.95, size_t max_num_buckets = 2048)
+      : relative_accuracy_(relative_accuracy)
+      , percentile_(percentile)
+      , max_num_buckets_(max_num_buckets) {
+    assert(relative_accuracy > 0.0 && relative_accuracy < 1.0);
+    assert(percentile >= 0.0 && percentile <= 1.0);
+    assert(max_num_buckets > 0);
+    gamma_ = (1.0 + relative_accuracy) / (1.0 - relative_accuracy);
+    inv_log_gamma_ = 1.0 / std::log(gamma_);
+    // Smallest magnitude that maps to a key in the key range
+    min_indexable_ =
+        std::max(std::numeric_limits<double>::min() * gamma_, std::exp(-kMaxKey / inv_log_gamma_));
+  }
+
+  /**
+   * @brief Adds a value to the sketch.
+   * @note Time complexity is O(1), amortized.
+   */
+  void add(double value) noexcept {
+    if (value > min_indexable_) {
+      positive_.add(key(value), 1, max_num_buckets_);
+    } else if (value < -min_indexable_) {
+      negative_.add(key(-value), 1, max_num_buckets_);
+    } else {
+      zero_count_++;
+    }
+    count_++;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  /**
+   * @brief Returns the value at quantile q (in [0, 1]) of all the values added so far.
+   * @return 0 if the sketch is empty.
+   */
+  [[nodiscard]] double getQuantile(double q) const noexcept {
+    if (empty()) return 0.0;
+    if (q <= 0.0) return min_;
+    if (q >= 1.0) return max_;
+
+    const double rank = q * double(count_ - 1);
+    double result;
+    uint64_t n = 0;
+    // Negative values, from most negative (highest key) to closest to zero
+    for (size_t i = negative_.counts.size(); i-- > 0;) {
+      n += negative_.counts[i];
+      if (double(n) > rank) {
+        result = -value(negative_.offset + int32_t(i));
+        return std::clamp(result, min_, max_);
+      }
+    }
+    n += zero_count_;
+    if (double(n) > rank) {
+      return std::clamp(0.0, min_, max_);
+    }
+    for (size_t i = 0; i < positive_.counts.size(); i++) {
+      n += positive_.counts[i];
+      if (double(n) > rank) {
+        result = value(positive_.offset + int32_t(i));
+        return std::clamp(result, min_, max_);
+      }
+    }
+    return max_;
+  }
+
+  /**
+   * @brief Returns the configured percentile of all the values added so far.
+   */
+  [[nodiscard]] double getPercentile() const noexcept { return getQuantile(percentile_); }
+
+  /**
+   * @brief Merges another sketch into this one.
+   * @return false (and leaves this sketch untouched) if the sketches have different accuracies.
+   */
+  bool merge(const DDSketch& other) noexcept {
+    if (other.gamma_ != gamma_) return false;
+    if (other.empty()) return true;
+    positive_.merge(other.positive_, max_num_buckets_);
+    negative_.merge(other.negative_, max_num_buckets_);
+    zero_count_ += other.zero_count_;
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    return true;
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return count_; }
+  [[nodiscard]] bool empty() const noexcept { return count_ == 0; }
+  [[nodiscard]] double min() const noexcept { return empty() ? 0.0 : min_; }
+  [[nodiscard]] double max() const noexcept { return empty() ? 0.0 : max_; }
+  [[nodiscard]] double sum() const noexcept { return sum_; }
+  [[nodiscard]] double mean() const noexcept { return empty() ? 0.0 : sum_ / double(count_); }
+  [[nodiscard]] double relativeAccuracy() const noexcept { return relative_accuracy_; }
+  [[nodiscard]] double getPercentileParameter() const noexcept { return percentile_; }
+
+  void setPercentileParameter(double value) noexcept {
+    assert(value >= 0.0 && value <= 1.0);
+    percentile_ = value;
+  }
+
+  /**
+   * @brief Returns the number of bytes used by the buckets.
+   */
+  [[nodiscard]] size_t memoryUsage() const noexcept {
+    return (positive_.counts.capacity() + negative_.counts.capacity()) * sizeof(uint64_t);
+  }
+
+  void reset() noexcept {
+    positive_.counts.clear();
+    negative_.counts.clear();
+    zero_count_ = 0;
+    count_ = 0;
+    sum_ = 0.0;
+    min_ = std::numeric_limits<double>::infinity();
+    max_ = -std::numeric_limits<double>::infinity();
+  }
+
+  /**
+   * @brief Serializes the sketch into a byte buffer (host byte order).
+   */
+  [[nodiscard]] std::vector<uint8_t> serialize() const {
+    using quantile_sketch_detail::put;
+    std::vector<uint8_t> out;
+    out.reserve(64 + (positive_.counts.size() + negative_.counts.size()) * sizeof(uint64_t));
+    put(out, kMagic);
+    put(out, relative_accuracy_);
+    put(out, percentile_);
+    put(out, uint64_t(max_num_buckets_));
+    put(out, zero_count_);
+    put(out, count_);
+    put(out, sum_);
+    put(out, min_);
+    put(out, max_);
+    for (const Store* s : {&positive_, &negative_}) {
+      put(out, s->offset);
+      put(out, uint64_t(s->counts.size()));
+      for (uint64_t c : s->counts) put(out, c);
+    }
+    return out;
+  }
+
+  /**
+   * @brief Reconstructs a sketch from the output of serialize().
+   * @return false if the buffer is not a valid serialized DDSketch.
+   */
+  static bool deserialize(const uint8_t* data, size_t len, DDSketch& sketch) {
+    using quantile_sketch_detail::get;
+    const uint8_t* end = data + len;
+    uint32_t magic = 0;
+    double accuracy = 0, percentile = 0;
+    uint64_t max_buckets = 0;
+    if (!get(data, end, magic) || magic != kMagic) return false;
+    if (!get(data, end, accuracy) || !(accuracy > 0.0 && accuracy < 1.0)) return false;
+    if (!get(data, end, percentile) || !(percentile >= 0.0 && percentile <= 1.0)) return false;
+    if (!get(data, end, max_buckets) || max_buckets == 0) return false;
+    DDSketch s(accuracy, percentile, size_t(max_buckets));
+    if (!get(data, end, s.zero_count_) || !get(data, end, s.count_) || !get(data, end, s.sum_) ||
+        !get(data, end, s.min_) || !get(data, end, s.max_)) {
+      return false;
+    }
+    for (Store* st : {&s.positive_, &s.negative_}) {
+      uint64_t n = 0;
+      if (!get(data, end, st->offset) || !get(data, end, n)) return false;
+      if (n > max_buckets || n > size_t(end - data) / sizeof(uint64_t)) return false;
+      if (n > 0 && (st->offset < -kMaxKey || int64_t(st->offset) + int64_t(n) - 1 > kMaxKey)) return false;
+      st->counts.resize(n);
+      for (auto& c : st->counts) get(data, end, c);
+    }
+    sketch = std::move(s);
+    return true;
+  }
+
+  static bool deserialize(const std::vector<uint8_t>& buf, DDSketch& sketch) {
+    return deserialize(buf.data(), buf.size(), sketch);
+  }
+
+private:
+  static constexpr uint32_t kMagic = 0x44445331;  // "DDS1"
+  // Keys stay within +-kMaxKey, so the int32_t arithmetic of Store cannot overflow
+  static constexpr int32_t kMaxKey = std::numeric_limits<int32_t>::max() / 2;
+
+  // Dense array of bucket counts, indexed from 'offset', collapsing the lowest keys when full.
+  struct Store {
+    std::vector<uint64_t> counts;
+    int32_t offset = 0;
+
+    void add(int32_t key, uint64_t n, size_t max_buckets) {
+      if (counts.empty()) {
+        counts.assign(1, 0);
+        offset = key;
+      }
+      if (key < offset) {
+        size_t grow = size_t(offset - key);
+        if (counts.size() + grow > max_buckets) {
+          grow = max_buckets - counts.size();
+          if (grow == 0) {
+            // Already at capacity, this key lands in the lowest bucket
+            counts[0] += n;
+            return;
+          }
+        }
+        counts.insert(counts.begin(), grow, 0);
+        offset -= int32_t(grow);
+        key = std::max(key, offset);
+      } else if (size_t(key - offset) >= counts.size()) {
+        size_t new_size = size_t(key - offset) + 1;
+        if (new_size > max_buckets) {
+          // Collapse the lowest buckets so that 'key' fits
+          size_t shift = new_size - max_buckets;
+          shift = std::min(shift, counts.size());
+          uint64_t collapsed = 0;
+          for (size_t i = 0; i < shift; i++) collapsed += counts[i];
+          counts.erase(counts.begin(), counts.begin() + ptrdiff_t(shift));
+          offset += int32_t(shift);
+          if (counts.empty()) {
+            counts.assign(1, 0);
+            offset = key - int32_t(max_buckets) + 1;
+          }
+          counts[0] += collapsed;
+          new_size = size_t(key - offset) + 1;
+        }
+        counts.resize(new_size, 0);
+      }
+      counts[size_t(key - offset)] += n;
+    }
+
+    void merge(const Store& other, size_t max_buckets) {
+      // Walk from the highest key down, so collapsing happens at most once
+      for (size_t i = other.counts.size(); i-- > 0;) {
+        if (other.counts[i] != 0) add(other.offset + int32_t(i), other.counts[i], max_buckets);
+      }
+    }
+  };
+
+  // Clamped: +inf, or huge values at a fine accuracy, would overflow the cast (NaN goes to the top)
+  int32_t key(double v) const noexcept {
+    const double k = std::ceil(std::log(v) * inv_log_gamma_);
+    if (!(k < kMaxKey)) return kMaxKey;
+    return int32_t(std::max(k, double(-kMaxKey)));
+  }
+  double value(int32_t key) const noexcept {
+    return 2.0 * std::pow(gamma_, double(key)) / (gamma_ + 1.0);
+  }
+
+  double relative_accuracy_;
+  double percentile_;
+  size_t max_num_buckets_;
+  double gamma_;
+  double inv_log_gamma_;
+  double min_indexable_;
+  Store positive_;
+  Store negative_;
+  uint64_t zero_count_ = 0;
+  uint64_t count_ = 0;
+  double sum_ = 0.0;
+  double min_ = std::numeric_limits<double>::infinity();
+  double max_ = -std::numeric_limits<double>::infinity();
+};
+
+/**
+ * @class KLLSketch
+ * @brief Quantile sketch with a rank-error guarantee (Karnin, Lang & Liberty, FOCS 2016).
+ *
+ * @note
+ * - The rank of a returned quantile is within about 1.65 / k of the requested one (k=200 gives ~1%
+ *   rank error) with high probability, independently of the value distribution.
+ * - Works for any copyable, totally ordered T; serialization requires a trivially copyable T.
+ * - Memory is O(k) items. 'add' is O(1) amortized, 'getPercentile' sorts the retained items,
+ *   O(k log k).
+ * - Summarizes the whole stream since the last reset(), not a sliding window.
+ */
+template <typename T>
+class KLLSketch {
+public:
+  /**
+   * @brief Constructor.
+   * @param k Accuracy parameter; larger k means more memory and lower error.
+   * @param percentile The percentile returned by getPercentile().
+   */
+  explicit KLLSketch(uint16_t k = 200, double percentile = 0.95)
+      : k_(std::max<uint16_t>(k, 8))
+      , percentile_(percentile)
+      , levels_(1) {
+    assert(percentile >= 0.0 && percentile <= 1.0);
+    capacity_ = capacity();
+  }
+
+  /**
+   * @brief Adds a value to the sketch.
+   * @note Time complexity is O(1), amortized.
+   */
+  void add(const T& value) {
+    if (count_ == 0) {
+      min_ = max_ = value;
+    } else {
+      if (value < min_) min_ = value;
+      if (max_ < value) max_ = value;
+    }
+    count_++;
+    levels_[0].push_back(value);
+    retained_++;
+    if (retained_ >= capacity_) compress();
+  }
+
+  /**
+   * @brief Returns the value at quantile q (in [0, 1]) of all the values added so far.
+   * @return T() if the sketch is empty.
+   */
+  [[nodiscard]] T getQuantile(double q) const {
+    if (empty()) return T();
+    if (q <= 0.0) return min_;
+    if (q >= 1.0) return max_;
+
+    std::vector<std::pair<T, uint64_t>> weighted;
+    weighted.reserve(retained_);
+    for (size_t h = 0; h < levels_.size(); h++) {
+      for (const T& v : levels_[h]) weighted.emplace_back(v, uint64_t(1) << h);
+    }
+    std::sort(weighted.begin(), weighted.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    const double rank = q * double(count_ - 1);
+    uint64_t n = 0;
+    for (const auto& [v, w] : weighted) {
+      n += w;
+      if (double(n) > rank) return v;
+    }
+    return max_;
+  }
+
+  /**
+   * @brief Returns the configured percentile of all the values added so far.
+   */
+  [[nodiscard]] T getPercentile() const { return getQuantile(percentile_); }
+
+  /**
+   * @brief Merges another sketch into this one.
+   * @return false if the sketches have different k.
+   */
+  bool merge(const KLLSketch& other) {
+    if (other.k_ != k_) return false;
+    if (other.empty()) return true;
+    if (empty()) {
+      min_ = other.min_;
+      max_ = other.max_;
+    } else {
+      if (other.min_ < min_) min_ = other.min_;
+      if (max_ < other.max_) max_ = other.max_;
+    }
+    if (levels_.size() < other.levels_.size()) levels_.resize(other.levels_.size());
+    for (size_t h = 0; h < other.levels_.size(); h++) {
+      levels_[h].insert(levels_[h].end(), other.levels_[h].begin(), other.levels_[h].end());
+    }
+    count_ += other.count_;
+    retained_ += other.retained_;
+    capacity_ = capacity();
+    while (retained_ >= capacity_) compress();
+    return true;
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return count_; }
+  [[nodiscard]] bool empty() const noexcept { return count_ == 0; }
+  [[nodiscard]] T min() const noexcept { return empty() ? T() : min_; }
+  [[nodiscard]] T max() const noexcept { return empty() ? T() : max_; }
+  [[nodiscard]] size_t retained() const noexcept { return retained_; }
+  [[nodiscard]] double getPercentileParameter() const noexcept { return percentile_; }
+
+  void setPercentileParameter(double value) noexcept {
+    assert(value >= 0.0 && value <= 1.0);
+    percentile_ = value;
+  }
+
+  /**
+   * @brief Returns the number of bytes used by the retained items.
+   */
+  [[nodiscard]] size_t memoryUsage() const noexcept {
+    size_t bytes = levels_.capacity() * sizeof(std::vector<T>);
+    for (const auto& l : levels_) bytes += l.capacity() * sizeof(T);
+    return bytes;
+  }
+
+  void reset() noexcept {
+    levels_.assign(1, {});
+    count_ = 0;
+    retained_ = 0;
+    capacity_ = capacity();
+  }
+
+  /**
+   * @brief Serializes the sketch into a byte buffer (host byte order).
+   */
+  [[nodiscard]] std::vector<uint8_t> serialize() const {
+    static_assert(std::is_trivially_copyable_v<T>, "KLLSketch serialization needs a trivially copyable T");
+    using quantile_sketch_detail::put;
+    std::vector<uint8_t> out;
+    out.reserve(64 + retained_ * sizeof(T));
+    put(out, kMagic);
+    put(out, uint32_t(sizeof(T)));
+    put(out, k_);
+    put(out, percentile_);
+    put(out, count_);
+    put(out, min_);
+    put(out, max_);
+    put(out, uint32_t(levels_.size()));
+    for (const auto& l : levels_) {
+      put(out, uint64_t(l.size()));
+      for (const T& v : l) put(out, v);
+    }
+    return out;
+  }
+
+  /**
+   * @brief Reconstructs a sketch from the output of serialize().
+   * @return false if the buffer is not a valid serialized KLLSketch<T>.
+   */
+  static bool deserialize(const uint8_t* data, size_t len, KLLSketch& sketch) {
+    using quantile_sketch_detail::get;
+    const uint8_t* end = data + len;
+    uint32_t magic = 0, tsize = 0, nlevels = 0;
+    uint16_t k = 0;
+    double percentile = 0;
+    if (!get(data, end, magic) || magic != kMagic) return false;
+    if (!get(data, end, tsize) || tsize != sizeof(T)) return false;
+    if (!get(data, end, k) || !get(data, end, percentile)) return false;
+    if (!(percentile >= 0.0 && percentile <= 1.0)) return false;
+    KLLSketch s(k, percentile);
+    if (!get(data, end, s.count_) || !get(data, end, s.min_) || !get(data, end, s.max_)) return false;
+    if (!get(data, end, nlevels) || nlevels == 0 || nlevels > 64) return false;
+    s.levels_.resize(nlevels);
+    for (auto& l : s.levels_) {
+      uint64_t n = 0;
+      // Divide rather than multiply: a hostile n must not wrap around
+      if (!get(data, end, n) || n > size_t(end - data) / sizeof(T)) return false;
+      l.resize(n);
+      for (T& v : l) get(data, end, v);
+      s.retained_ += n;
+    }
+    s.capacity_ = s.capacity();
+    sketch = std::move(s);
+    return true;
+  }
+
+  static bool deserialize(const std::vector<uint8_t>& buf, KLLSketch& sketch) {
+    return deserialize(buf.data(), buf.size(), sketch);
+  }
+
+private:
+  static constexpr uint32_t kMagic = 0x4b4c4c31;  // "KLL1"
+
+  // Capacity of level h, geometrically decreasing (factor 2/3) from the top level down.
+  size_t levelCapacity(size_t h) const noexcept {
+    size_t depth = levels_.size() - 1 - h;
+    double c = double(k_) * std::pow(2.0 / 3.0, double(depth));
+    return std::max<size_t>(2, size_t(std::ceil(c)));
+  }
+
+  size_t capacity() const noexcept {
+    size_t total = 0;
+    for (size_t h = 0; h < levels_.size(); h++) total += levelCapacity(h);
+    return total;
+  }
+
+  // Halve the lowest level that is over capacity, promoting one item of every pair.
+  void compress() {
+    for (size_t h = 0; h < levels_.size(); h++) {
+      if (levels_[h].size() < levelCapacity(h)) continue;
+      if (h + 1 == levels_.size()) {
+        levels_.emplace_back();
+        capacity_ = capacity();
+      }
+      auto& level = levels_[h];
+      std::sort(level.begin(), level.end());
+      // An odd item out stays on this level
+      size_t pairs = level.size() / 2;
+      size_t first = level.size() - 2 * pairs;
+      size_t pick = size_t(rng_() & 1u);
+      auto& next = levels_[h + 1];
+      for (size_t i = 0; i < pairs; i++) next.push_back(level[first + 2 * i + pick]);
+      level.resize(first);
+      retained_ -= pairs;
+      return;
+    }
+  }
+
+  uint16_t k_;
+  double percentile_;
+  std::vector<std::vector<T>> levels_;
+  uint64_t count_ = 0;
+  size_t retained_ = 0;
+  size_t capacity_ = 0;  ///< Sum of the level capacities, recomputed when a level is added.
+  T min_ = T();
+  T max_ = T();
+  std::minstd_rand rng_;
+};
+
+static_assert(PercentileEstimator<PercentileBuffer<double>>);
+static_assert(MergeablePercentileEstimator<DDSketch>);
+static_assert(MergeablePercentileEstimator<KLLSketch<double>>);
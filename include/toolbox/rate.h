@@ -3,11 +3,26 @@
 
 #include <array>
 
+// Rate of change of a monotonic counter, e.g. messages received.
+// Feed it (counter, time) points; getRate() averages the rate over the last 'window_seconds'.
+// Both getRate() and getEwmaRate() are O(1): the window is tracked with running sums.
 class Rate {
 public:
+  // Exponentially weighted rates, like the load averages, computed from the same points.
+  enum EwmaWindow {
+    EWMA_1S,
+    EWMA_10S,
+    EWMA_60S,
+    EWMA_COUNT,
+  };
+
   Rate(double window_seconds = 5.0) { window_seconds_ = window_seconds; }
   void addPoint(size_t num, double t);
   double getRate(bool no_divide_by_zero = true) const;
+  // As of the last point. Pass the current time t to also decay the average for the time since,
+  // which counts as no change: otherwise the last burst is reported until the next point.
+  double getEwmaRate(EwmaWindow window) const { return ewma_[window]; }
+  double getEwmaRate(EwmaWindow window, double t) const;
 
 private:
   struct Change {
@@ -19,7 +34,19 @@ private:
   double window_seconds_;
   std::array<Change, array_size_> changes_;
   Change prev_change_ = {0, -1};
-  bool filled_ = false;
+
+  // The changes in the window are changes_[window_start_] onwards, window_count_ of them
+  // (the latest one included). Times in the sums are relative to t_base_, to keep precision.
+  int window_start_ = 0;
+  int window_count_ = 0;
+  size_t num_sum_ = 0;
+  double t_sum_ = 0;
+  double t_base_ = 0;
+
+  Change ewma_prev_ = {0, -1};
+  double ewma_[EWMA_COUNT] = {};
 
   int loopedIndex(int index) const;
+  void recomputeSums();
+  void updateEwma(size_t num, double t);
 };
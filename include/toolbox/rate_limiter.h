@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free rate limiters, for throttling log output, network sends, etc. from many threads.
+//
+// Both limiters allow 'rate' operations per second on average, with bursts of up to 'burst'
+// operations, and keep their whole state in one atomic 64-bit time. A tryAcquire() decision is one
+// load and one compare-and-swap (retried only if another thread won the race). acquire() reserves
+// its tokens up front and then sleeps exactly until they become available, so waiting threads are
+// served in reservation order without a mutex.
+//
+// 'rate' must be positive. Rates below one operation every 31 years are raised to it.
+//
+// Times are nanoseconds of the steady clock; the overloads taking 'now_ns' exist for testing and for
+// callers that already have the current time.
+
+// Token bucket: the bucket holds up to 'burst' tokens and refills at 'rate' tokens per second.
+// It starts full. The state is the time at which the bucket would be empty.
+class TokenBucket {
+public:
+  TokenBucket(double rate, double burst);
+
+  // Take n tokens if they are available now. Never blocks.
+  bool tryAcquire(double n = 1.0) { return tryAcquire(n, now()); }
+  bool tryAcquire(double n, int64_t now_ns);
+
+  // Take n tokens, sleeping until they are available. Returns the time slept, in nanoseconds.
+  int64_t acquire(double n = 1.0);
+  // Reserve n tokens; returns how long the caller has to wait before using them (0 if available).
+  int64_t reserve(double n, int64_t now_ns);
+
+  // Tokens currently in the bucket (negative while acquire() callers are waiting).
+  double available() const { return available(now()); }
+  double available(int64_t now_ns) const;
+
+  double rate() const { return 1e9 / ns_per_token_; }
+  double burst() const { return burst_; }
+
+  static int64_t now();
+
+private:
+  double ns_per_token_;
+  double burst_;
+  int64_t burst_ns_;
+  std::atomic<int64_t> empty_at_ns_;
+};
+
+// Generic Cell Rate Algorithm: the state is the theoretical arrival time (TAT) of the next
+// operation. A request is conforming if it does not push the TAT more than 'burst' emission
+// intervals past now. Equivalent to a token bucket, but with no tokens to query; this is the form
+// used by network traffic shapers.
+class GcraLimiter {
+public:
+  GcraLimiter(double rate, double burst = 1.0);
+
+  bool tryAcquire(double n = 1.0) { return tryAcquire(n, TokenBucket::now()); }
+  bool tryAcquire(double n, int64_t now_ns);
+
+  int64_t acquire(double n = 1.0);
+  int64_t reserve(double n, int64_t now_ns);
+
+  double rate() const { return 1e9 / emission_interval_ns_; }
+
+private:
+  double emission_interval_ns_;
+  int64_t tolerance_ns_;  // burst * emission interval
+  std::atomic<int64_t> tat_ns_;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Rates of many counters (e.g. one per topic) keyed by a dense integer id.
+//
+// Instead of one Rate per id, all ids share a ring of time buckets. Each bucket is one row holding
+// the counter of every id at the bucket's time, so the table is stored struct-of-arrays style:
+// num_buckets doubles per id (80 bytes with the defaults, against ~1.6 KB for a Rate). Computing all
+// the rates is a single pass over two rows, which the compiler vectorizes.
+//
+// Like Rate, points are cumulative counters. A counter is assumed unchanged until its id is updated
+// again, so a counter that stops changing sees its rate decay to zero as the window moves on.
+class RateTable {
+public:
+  // Highest number of ids addPoint(s) grow the table to, by default: 80 MB with 10 buckets.
+  static constexpr size_t kDefaultMaxIds = size_t(1) << 20;
+
+  RateTable(double window_seconds = 5.0, size_t num_ids = 0, int num_buckets = 10);
+
+  // Number of ids tracked; ids are 0 .. size() - 1.
+  size_t size() const { return num_ids_; }
+  // Grow (or shrink) the number of ids, to any size. addPoint(s) also grow the table as needed,
+  // up to max_ids.
+  void resize(size_t num_ids);
+  // Bound the growth by addPoint(s), so a stray id (e.g. 0xFFFFFFFF) cannot allocate gigabytes.
+  void setMaxIds(size_t max_ids) { max_ids_ = max_ids; }
+  size_t maxIds() const { return max_ids_; }
+
+  // Counter of 'id' is 'num' at time t. Points of ids at or past both size() and max_ids are
+  // ignored; returns the number of points ignored.
+  size_t addPoint(uint32_t id, size_t num, double t) { return addPoints(&id, &num, 1, t); }
+  // Counters of ids[i] are nums[i] at time t.
+  size_t addPoints(const uint32_t* ids, const size_t* nums, size_t count, double t);
+  size_t addPoints(std::span<const uint32_t> ids, std::span<const size_t> nums, double t);
+
+  // Rate of one id, in counts per second, over the window.
+  double getRate(uint32_t id) const;
+  // Rates of all the ids; 'out' must hold size() values.
+  void getRates(double* out) const;
+  void getRates(std::vector<double>& out) const;
+
+private:
+  double* row(int bucket) { return counts_.data() + size_t(bucket) * stride_; }
+  const double* row(int bucket) const { return counts_.data() + size_t(bucket) * stride_; }
+  // Oldest bucket to compute the rates against, and the time span to the latest bucket.
+  int baseBucket(double& dt) const;
+  void advance(double t);
+
+  double window_seconds_;
+  double bucket_seconds_;  // minimum time between the start of two buckets
+  int num_buckets_;
+  size_t num_ids_ = 0;
+  size_t max_ids_ = kDefaultMaxIds;
+  size_t stride_ = 0;           // row length, num_ids_ rounded up for alignment
+  std::vector<double> counts_;  // num_buckets_ rows of stride_ counters
+  std::vector<double> times_;   // time of the last update of each bucket
+  std::vector<uint8_t> seen_;   // whether each id had a point yet
+  int current_ = 0;             // bucket being updated
+  int used_ = 0;                // buckets holding data
+  double current_start_ = 0;    // time the current bucket was opened
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "taskthread.h"
+
+// A TaskThread that multiplexes any number of fds and timers with epoll, and dispatches their
+// handlers as tasks:
+//
+//   Reactor reactor;
+//   reactor.Start();
+//   reactor.AddFd(sock, EPOLLIN | EPOLLET, [](int fd, uint32_t events) { DrainSocket(fd); }, &worker);
+//   reactor.AddTimer(std::chrono::milliseconds(10), std::chrono::milliseconds(10), []() { Tick(); });
+//
+// The reactor sleeps in epoll_wait() on its fds, the timers' timerfds, and the eventfd that
+// Push() writes to: tasks pushed to the reactor wake it up like any TaskThread. A handler runs on
+// the reactor thread itself, or is pushed to the TaskThread given at registration.
+//
+// Level-triggered fds handled on another thread are armed with EPOLLONESHOT and re-armed once their
+// handler has run, so the reactor does not report them again while the handler is pending. With
+// EPOLLET the handler is pushed on every edge, and must read or write until EAGAIN. If a bounded
+// thread (TaskThread::SetCapacity()) discards the handler, the fd is re-armed and reported again:
+// with TASK_OVERFLOW_REJECT, the reactor retries until the thread has room.
+//
+// If the epoll fd cannot be created, the reactor logs it and runs as a plain TaskThread: pushed tasks
+// still run, but AddFd() and AddTimer() fail.
+//
+// The reactor may be destroyed while handlers are still queued or running on other threads: from
+// then on, queued handlers are skipped, and running ones re-arm nothing.
+class Reactor : public TaskThread {
+public:
+  typedef std::function<void(int fd, uint32_t events)> FDHANDLER;
+  typedef std::function<void()> TIMERHANDLER;
+
+  Reactor(const char* szName = "reactor");
+  ~Reactor() override;
+
+  // Watch fd for 'events' (EPOLLIN, EPOLLOUT, optionally EPOLLET). The handler gets the ready
+  // events, on pThread, or on the reactor thread if pThread is null or the reactor. Returns false
+  // if the fd is already watched or epoll rejects it. Any thread may call these.
+  bool AddFd(int fd, uint32_t events, FDHANDLER handler, TaskThread* pThread = nullptr);
+  bool ModifyFd(int fd, uint32_t events);
+  // After this, the handler is not called again, but may still be running. The fd is not closed.
+  void RemoveFd(int fd);
+
+  // Call handler after 'delay', then every 'period' (0: once). Returns the timer id, or -1.
+  int64_t AddTimer(std::chrono::nanoseconds delay, std::chrono::nanoseconds period, TIMERHANDLER handler,
+                   TaskThread* pThread = nullptr);
+  void RemoveTimer(int64_t nTimerId);
+
+  size_t GetFdCount() const;
+
+protected:
+  struct Entry {
+    int fd = -1;
+    uint32_t nEvents = 0;
+    bool bTimer = false;
+    bool bOneShot = false;  // re-armed by the dispatched handler
+    FDHANDLER fdHandler;
+    TIMERHANDLER timerHandler;
+    TaskThread* pThread = nullptr;
+    std::atomic_bool bActive{true};
+  };
+  typedef std::shared_ptr<Entry> ENTRYPTR;
+
+  void IdlePoll() override;
+  // Owned with the handlers pushed to other threads, which may outlive the reactor
+  struct Shared {
+    std::mutex mutex;   // guards the maps, and epoll_ctl against re-arming removed entries
+    int nEpollFd = -1;  // closed, and -1, once the reactor is destroyed
+  };
+  typedef std::shared_ptr<Shared> SHAREDPTR;
+
+  // Runs an fd handler on another thread, then re-arms the fd, even if the thread discards it
+  struct HandlerTask final : public AbstractTask {
+    HandlerTask(SHAREDPTR pSharedIn, ENTRYPTR pEntryIn, uint64_t nIdIn, uint32_t nEventsIn)
+        : pShared(std::move(pSharedIn))
+        , pEntry(std::move(pEntryIn))
+        , nId(nIdIn)
+        , nEvents(nEventsIn) {
+      szName = "Reactor fd handler";
+    }
+    void Execute() override;
+    void Discard() override;
+
+    static void* operator new(size_t size) { return TaskPool::Allocate(size); }
+    static void operator delete(void* p) noexcept { TaskPool::Free(p); }
+
+    SHAREDPTR pShared;
+    ENTRYPTR pEntry;
+    uint64_t nId;
+    uint32_t nEvents;
+  };
+
+  void Dispatch(uint64_t nId, uint32_t nEvents);
+  static void Rearm(Shared& shared, uint64_t nId, const Entry& entry, bool bDiscarded);
+  void Remove(uint64_t nId);
+  bool Register(uint64_t nId, ENTRYPTR pEntry);
+
+  // epoll data of the internal fds; registrations start after them
+  static constexpr uint64_t kWakeId = 0;
+  static constexpr uint64_t kQuitId = 1;
+
+  SHAREDPTR m_pShared = std::make_shared<Shared>();
+  std::vector<epoll_event> m_events;
+
+  std::unordered_map<uint64_t, ENTRYPTR> m_entries;
+  std::unordered_map<int, uint64_t> m_fdIds;  // watched fds, not timers
+  uint64_t m_nNextId = 2;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "rate.h"
+
+// Counter that many threads can increment concurrently, with the windowed rate semantics of Rate.
+//
+// Every thread increments its own cache-line sized stripe, so counting from a hot path is a single
+// relaxed, normally uncontended, atomic add; nothing is shared between producers. Readers sum the
+// stripes on demand: call sample(t) periodically (e.g. from a status page) to feed the total into the
+// window, then query getRate()/getEwmaRate() exactly as for a Rate.
+class StripedRate {
+public:
+  // num_stripes == 0 picks one stripe per hardware thread. It is rounded up to a power of two.
+  StripedRate(double window_seconds = 5.0, unsigned num_stripes = 0);
+
+  // Count 'n' events. Safe to call from any number of threads.
+  void add(size_t n = 1) noexcept {
+    stripes_[threadStripe() & mask_].count.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  // Sum of all the counts so far.
+  size_t total() const noexcept;
+
+  // Record the current total at time t into the rate window.
+  void sample(double t);
+
+  double getRate(bool no_divide_by_zero = true) const;
+  double getEwmaRate(Rate::EwmaWindow window) const;
+  double getEwmaRate(Rate::EwmaWindow window, double t) const;
+
+  unsigned numStripes() const { return mask_ + 1; }
+
+private:
+  struct alignas(64) Stripe {
+    std::atomic<size_t> count{0};
+  };
+
+  // Stripe of the calling thread, assigned round-robin on first use.
+  static unsigned threadStripe() noexcept {
+    static std::atomic<unsigned> next_stripe{0};
+    thread_local unsigned stripe = next_stripe.fetch_add(1, std::memory_order_relaxed);
+    return stripe;
+  }
+
+  std::unique_ptr<Stripe[]> stripes_;
+  unsigned mask_;
+  mutable std::mutex reader_mutex_;  // sample() and the getters may run on different reader threads
+  Rate rate_;
+};
@@ -1,12 +1,58 @@
 #pragma once
+#include <coroutine>
+#include <cstdint>
 #include <deque>
 #include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <utility>
+
+#include "inline_function.h"
+#include "task_future.h"
+#include "task_pool.h"
+
+// Priority classes of the TaskThread queue, highest first.
+enum TaskPriority {
+  TASK_PRIORITY_CRITICAL,
+  TASK_PRIORITY_HIGH,
+  TASK_PRIORITY_NORMAL,
+  TASK_PRIORITY_LOW,
+  TASK_PRIORITY_COUNT
+};
 
 struct AbstractTask {
+  AbstractTask() = default;
+  // Copies are not linked into any queue
+  AbstractTask(const AbstractTask&) {}
+  AbstractTask& operator=(const AbstractTask&) { return *this; }
   virtual ~AbstractTask();
   virtual void Execute() = 0;
+  // Called instead of Execute() when a bounded queue rejects or drops the task (see
+  // TaskThread::SetCapacity()). Tasks that own themselves delete themselves here.
+  virtual void Discard() {}
+
+  // Intrusive link, used by the task queue currently holding the task. A task can only be in one
+  // queue at a time.
+  AbstractTask* pNextTask = nullptr;
+
+  // Scheduling of the task in its queue, reset when it is popped.
+  TaskPriority nPriority = TASK_PRIORITY_NORMAL;
+  bool bCounted = false;    // holds a slot of the queue size, see TaskThread::GetQueueSize()
+  int64_t nDeadlineNs = 0;  // steady clock, 0 for none
+  int64_t nQueuedNs = 0;    // when the task was pushed, for aging and DROP_OLDEST
+  int64_t nPushedNs = 0;    // when the task was pushed, only while statistics are enabled
+
+  // Tag for the statistics of TaskThread::EnableStats(): a name (nLine 0), or the source file and
+  // line of the PushFunc() call. Must point to a string that outlives the statistics.
+  const char* szName = nullptr;
+  uint32_t nLine = 0;
+
+  // False for tasks that must run, such as coroutine hops: a full bounded queue takes them over
+  // capacity instead of discarding them.
+  bool bDiscardable = true;
 };
 typedef std::deque<AbstractTask*> TASKQUEUE;
 
@@ -54,7 +100,8 @@ struct Task<void> : public AbstractTask {
   TASKEXEC execution;
 };
 
-// Task with a promise and a future.  The requeusting thread polls the result.
+// Task with a promise and a future.  The requeusting thread polls the result, or better, chains
+// continuations with Then() (see task_future.h).
 // What to name it: FuturisticTask?, PromiscuousTask?
 template <typename ResultType>
 struct WaitableTask : public AbstractTask {
@@ -62,6 +109,7 @@ struct WaitableTask : public AbstractTask {
   typedef std::function<ResultType(TASKTYPE*)> TASKEXEC;
   typedef std::promise<ResultType> PROMISETYPE;
   typedef std::future<ResultType> FUTURETYPE;
+  typedef TaskFuture<ResultType> TASKFUTURETYPE;
 
   explicit WaitableTask() {}
   template <typename FunctionType>
@@ -71,14 +119,55 @@ struct WaitableTask : public AbstractTask {
 
   FUTURETYPE GetFuture() { return promise.get_future(); }
 
+  // Non-blocking handle on the result, which outlives the task. Its shared state is only allocated
+  // by the first call, so tasks that only use GetFuture() do not pay for it: call before the task
+  // runs. If the first call comes after, the result is gone and the future fails with
+  // std::logic_error.
+  TASKFUTURETYPE GetTaskFuture() const {
+    std::lock_guard lock(futureMutex);
+    if (!pFutureState) {
+      pFutureState = std::make_shared<typename TASKFUTURETYPE::STATE>();
+      if (bExecuted) {
+        pFutureState->SetException(
+            std::make_exception_ptr(std::logic_error("GetTaskFuture() first called after the task ran")));
+      }
+    }
+    return TASKFUTURETYPE(pFutureState);
+  }
+
+  // Push fn(result) to 'executor' (a TaskThread or a ThreadPool) once the task has run.
+  template <typename ExecutorType, typename FunctionType>
+  auto Then(ExecutorType& executor, FunctionType fn) const {
+    return GetTaskFuture().Then(executor, std::move(fn));
+  }
+
+  // The result goes to the future last: the thread waiting on it may delete the task.
+  // An exception thrown by the execution goes to both futures.
   void Execute() override {
     TASKEXEC temp = execution;
-    ResultType result = temp(this);
-    promise.set_value(result);
+    std::shared_ptr<typename TASKFUTURETYPE::STATE> pState;
+    {
+      std::lock_guard lock(futureMutex);
+      bExecuted = true;
+      pState = pFutureState;
+    }
+    try {
+      ResultType result = temp(this);
+      // Copied only when there is a TaskFuture to share it with
+      if (pState) pState->SetValue(result);
+      promise.set_value(std::move(result));
+    } catch (...) {
+      if (pState) pState->SetException(std::current_exception());
+      promise.set_exception(std::current_exception());
+    }
   }
 
   TASKEXEC execution;
   PROMISETYPE promise;
+  // See GetTaskFuture(), which may be called while the task runs
+  mutable std::mutex futureMutex;
+  mutable std::shared_ptr<typename TASKFUTURETYPE::STATE> pFutureState;
+  bool bExecuted = false;
 };
 
 // Async Task template specialization has no result.
@@ -100,3 +189,53 @@ struct StringTask : public AbstractTask {
   TASKEXEC execution;
   std::string strValue;
 };
+
+// Task running a callable taking no argument, for PushFunc. The callable is stored inline (no
+// std::function, no copy when it runs) and the task itself comes from the TaskPool. The task deletes
+// itself after running: the queue that executes it owns it.
+struct FuncTask final : public AbstractTask {
+  static constexpr size_t kInlineSize = 48;
+  typedef InlineFunction<void(), kInlineSize> TASKEXEC;
+
+  template <typename FunctionType>
+  explicit FuncTask(FunctionType&& execfn)
+      : execution(std::forward<FunctionType>(execfn)) {}
+  ~FuncTask() override;
+
+  void Execute() override {
+    execution();
+    delete this;
+  }
+  void Discard() override { delete this; }
+
+  static void* operator new(size_t size) { return TaskPool::Allocate(size); }
+  static void operator delete(void* p) noexcept { TaskPool::Free(p); }
+
+  TASKEXEC execution;
+};
+
+// Awaiter returned by TaskThread::schedule() and ThreadPool::schedule(): 'co_await thread.schedule()'
+// suspends the coroutine and resumes it on that thread. The awaiter is itself the task pushed to the
+// thread, and lives in the coroutine frame: hopping threads allocates nothing.
+template <typename ExecutorType>
+struct ScheduleAwaiter : public AbstractTask {
+  explicit ScheduleAwaiter(ExecutorType& executor)
+      : pExecutor(&executor) {
+    bDiscardable = false;  // the coroutine would never resume
+  }
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    hCoroutine = handle;
+    pExecutor->Push(this);
+  }
+  void await_resume() const noexcept {}
+
+  void Execute() override {
+    std::coroutine_handle<> handle = hCoroutine;  // resuming may destroy this awaiter
+    handle.resume();
+  }
+
+  ExecutorType* pExecutor;
+  std::coroutine_handle<> hCoroutine;
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "task.h"
+#include "task_pool.h"
+#include "taskthread.h"
+
+// C++20 coroutines over TaskThreads, instead of Tasks that swap their execution function and
+// re-queue themselves:
+//
+//   CoTask<Image> LoadImage(std::string path) {
+//     co_await ioThread.schedule();    // continue on the I/O thread
+//     co_return DecodeFile(path);
+//   }
+//   CoTask<void> Update() {            // running on the main thread
+//     Image image = co_await LoadImage("a.png");
+//     Show(image);                     // back on the main thread
+//   }
+//   CoSpawn(mainThread, Update());
+//
+// A CoTask starts when it is awaited. When it completes, the awaiting coroutine resumes on the
+// TaskThread it was running on when it awaited (see TaskThread::GetCurrent()), whichever thread the
+// CoTask finished on. Coroutine frames come from the TaskPool, and thread hops are tasks embedded in
+// the frames, so a warmed-up chain of coroutines does not allocate.
+
+template <typename T = void>
+class CoTask;
+
+namespace task_coroutine_detail {
+
+// Frames are recycled through the TaskPool
+struct PooledFrame {
+  static void* operator new(size_t size) { return TaskPool::Allocate(size); }
+  static void operator delete(void* p) noexcept { TaskPool::Free(p); }
+};
+
+struct PromiseBase : PooledFrame {
+  // Resumes the awaiting coroutine on its TaskThread
+  struct ResumeTask : public AbstractTask {
+    ResumeTask() { bDiscardable = false; }
+    void Execute() override {
+      std::coroutine_handle<> handle = hContinuation;  // resuming may destroy this task
+      handle.resume();
+    }
+    std::coroutine_handle<> hContinuation;
+  };
+
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename PromiseType>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<PromiseType> handle) noexcept {
+      PromiseBase& promise = handle.promise();
+      if (!promise.resumeTask.hContinuation) return std::noop_coroutine();
+      if (promise.pHomeThread && promise.pHomeThread != TaskThread::GetCurrent()) {
+        promise.pHomeThread->Push(&promise.resumeTask);
+        return std::noop_coroutine();
+      }
+      return promise.resumeTask.hContinuation;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+  TaskThread* pHomeThread = nullptr;
+  ResumeTask resumeTask;
+  std::exception_ptr exception;
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  CoTask<T> get_return_object() noexcept;
+
+  template <typename U>
+  void return_value(U&& value) {
+    ::new (static_cast<void*>(&storage)) T(std::forward<U>(value));
+    bHasValue = true;
+  }
+
+  T TakeResult() {
+    if (exception) std::rethrow_exception(exception);
+    return std::move(*std::launder(reinterpret_cast<T*>(&storage)));
+  }
+
+  ~Promise() {
+    if (bHasValue) std::launder(reinterpret_cast<T*>(&storage))->~T();
+  }
+
+  alignas(T) unsigned char storage[sizeof(T)];
+  bool bHasValue = false;
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  CoTask<void> get_return_object() noexcept;
+  void return_void() noexcept {}
+  void TakeResult() {
+    if (exception) std::rethrow_exception(exception);
+  }
+};
+
+// Fire-and-forget coroutine, destroyed when it completes
+struct Detached {
+  struct promise_type : PooledFrame {
+    Detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+}  // namespace task_coroutine_detail
+
+// Lazily started coroutine producing a T. Move-only; awaiting it consumes it.
+template <typename T>
+class CoTask {
+public:
+  typedef task_coroutine_detail::Promise<T> promise_type;
+  typedef std::coroutine_handle<promise_type> HANDLE;
+
+  CoTask() noexcept = default;
+  explicit CoTask(HANDLE handle) noexcept
+      : m_handle(handle) {}
+  CoTask(CoTask&& other) noexcept
+      : m_handle(std::exchange(other.m_handle, nullptr)) {}
+  CoTask& operator=(CoTask&& other) noexcept {
+    if (this != &other) {
+      if (m_handle) m_handle.destroy();
+      m_handle = std::exchange(other.m_handle, nullptr);
+    }
+    return *this;
+  }
+  CoTask(const CoTask&) = delete;
+  CoTask& operator=(const CoTask&) = delete;
+  ~CoTask() {
+    if (m_handle) m_handle.destroy();
+  }
+
+  bool IsValid() const { return bool(m_handle); }
+
+  struct Awaiter {
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> hAwaiting) noexcept {
+      promise_type& promise = handle.promise();
+      promise.resumeTask.hContinuation = hAwaiting;
+      promise.pHomeThread = TaskThread::GetCurrent();
+      return handle;  // start the task, without growing the stack
+    }
+    T await_resume() { return handle.promise().TakeResult(); }
+
+    HANDLE handle;
+  };
+
+  // The task must be awaited at most once, as an rvalue: 'co_await std::move(task)', or directly
+  // 'co_await MakeTask()'.
+  Awaiter operator co_await() && noexcept { return Awaiter{m_handle}; }
+
+private:
+  HANDLE m_handle;
+};
+
+namespace task_coroutine_detail {
+
+template <typename T>
+inline CoTask<T> Promise<T>::get_return_object() noexcept {
+  return CoTask<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> Promise<void>::get_return_object() noexcept {
+  return CoTask<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+template <typename ExecutorType, typename T>
+Detached Spawn(ExecutorType& executor, CoTask<T> task) {
+  co_await executor.schedule();
+  co_await std::move(task);
+}
+
+template <typename T>
+Detached SyncWait(CoTask<T> task, std::promise<T>& result) {
+  try {
+    if constexpr (std::is_void_v<T>) {
+      co_await std::move(task);
+      result.set_value();
+    } else {
+      result.set_value(co_await std::move(task));
+    }
+  } catch (...) {
+    result.set_exception(std::current_exception());
+  }
+}
+
+}  // namespace task_coroutine_detail
+
+// Start a coroutine on a TaskThread or ThreadPool, without waiting for it. Its result, if any, is
+// dropped; an escaping exception terminates the program.
+template <typename ExecutorType, typename T>
+void CoSpawn(ExecutorType& executor, CoTask<T> task) {
+  task_coroutine_detail::Spawn(executor, std::move(task));
+}
+
+// Run a coroutine and block the calling thread until it completes. The coroutine starts on the
+// calling thread. Do not call from a TaskThread: the coroutine might need it to resume.
+template <typename T>
+T CoSyncWait(CoTask<T> task) {
+  std::promise<T> result;
+  std::future<T> future = result.get_future();
+  task_coroutine_detail::SyncWait(std::move(task), result);
+  return future.get();
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "inline_function.h"
+
+// Non-blocking futures for task results. Instead of parking a thread on std::future::get(), or
+// polling wait_for(0) every frame, attach a continuation that is pushed to a chosen TaskThread (or
+// ThreadPool) once the result is set:
+//
+//   loader.GetTaskFuture()
+//       .Then(workerThread, [](const Mesh& mesh) { return Simplify(mesh); })
+//       .Then(mainThread, [](const Mesh& simple) { Upload(simple); });
+//
+// Continuations only run once the value is available, so none of them ever blocks. An exception
+// thrown by a task or a continuation skips the following continuations and is propagated to the end
+// of the chain.
+
+template <typename T>
+class TaskFuture;
+
+namespace task_future_detail {
+
+// void results are stored as std::monostate
+template <typename T>
+using Stored = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+template <typename T>
+struct State {
+  typedef InlineFunction<void()> CALLBACK;
+
+  void SetValue(Stored<T> v) {
+    std::vector<CALLBACK> callbacks;
+    {
+      std::lock_guard lock(mutex);
+      if (bReady) return;
+      value.emplace(std::move(v));
+      bReady = true;
+      callbacks.swap(pending);
+    }
+    for (auto& callback : callbacks) callback();
+  }
+
+  void SetException(std::exception_ptr e) {
+    std::vector<CALLBACK> callbacks;
+    {
+      std::lock_guard lock(mutex);
+      if (bReady) return;
+      exception = e;
+      bReady = true;
+      callbacks.swap(pending);
+    }
+    for (auto& callback : callbacks) callback();
+  }
+
+  // Runs 'callback' on the thread setting the result, or right away if it is already set.
+  void OnReady(CALLBACK callback) {
+    {
+      std::lock_guard lock(mutex);
+      if (!bReady) {
+        pending.push_back(std::move(callback));
+        return;
+      }
+    }
+    callback();
+  }
+
+  std::mutex mutex;
+  bool bReady = false;
+  std::optional<Stored<T>> value;
+  std::exception_ptr exception;
+  std::vector<CALLBACK> pending;
+};
+
+template <typename T, typename F>
+auto InvokeWith(F& fn, const std::optional<Stored<T>>& value) {
+  if constexpr (std::is_void_v<T>) {
+    (void)value;
+    return fn();
+  } else {
+    return fn(*value);
+  }
+}
+
+}  // namespace task_future_detail
+
+// Shared handle to the result of a task. Copyable; all copies see the same result.
+template <typename T>
+class TaskFuture {
+public:
+  typedef task_future_detail::State<T> STATE;
+
+  TaskFuture()
+      : m_state(std::make_shared<STATE>()) {}
+  explicit TaskFuture(std::shared_ptr<STATE> state)
+      : m_state(std::move(state)) {}
+
+  bool IsReady() const {
+    std::lock_guard lock(m_state->mutex);
+    return m_state->bReady;
+  }
+
+  // The result, once IsReady(). Rethrows the exception if the task failed.
+  const task_future_detail::Stored<T>& GetValue() const {
+    std::lock_guard lock(m_state->mutex);
+    if (m_state->exception) std::rethrow_exception(m_state->exception);
+    return *m_state->value;
+  }
+
+  // Producer side
+  void SetValue(task_future_detail::Stored<T> value) const { m_state->SetValue(std::move(value)); }
+  void SetException(std::exception_ptr e) const { m_state->SetException(e); }
+
+  // Push fn(value) (or fn() for TaskFuture<void>) to 'executor' once the result is set, and return
+  // the future of its result. If this future holds an exception, fn is skipped and the returned
+  // future gets the exception.
+  template <typename ExecutorType, typename FunctionType>
+  auto Then(ExecutorType& executor, FunctionType fn) const {
+    using R = decltype(task_future_detail::InvokeWith<T>(fn, m_state->value));
+    TaskFuture<R> next;
+    m_state->OnReady([&executor, state = m_state, next, fn = std::move(fn)]() mutable {
+      if (state->exception) {
+        next.SetException(state->exception);
+        return;
+      }
+      executor.PushFunc([state = std::move(state), next = std::move(next), fn = std::move(fn)]() mutable {
+        try {
+          if constexpr (std::is_void_v<R>) {
+            task_future_detail::InvokeWith<T>(fn, state->value);
+            next.SetValue(std::monostate());
+          } else {
+            next.SetValue(task_future_detail::InvokeWith<T>(fn, state->value));
+          }
+        } catch (...) {
+          next.SetException(std::current_exception());
+        }
+      });
+    });
+    return next;
+  }
+
+  // Call fn() on the thread that sets the result, or right away if it is set. For combinators;
+  // fn must be short and must not block.
+  void OnReady(InlineFunction<void()> fn) const { m_state->OnReady(std::move(fn)); }
+
+private:
+  std::shared_ptr<STATE> m_state;
+};
+
+// Future of all the results, in order, ready once every input is. The first exception fails it
+// right away.
+template <typename T>
+TaskFuture<std::vector<task_future_detail::Stored<T>>> WhenAll(const std::vector<TaskFuture<T>>& futures) {
+  typedef task_future_detail::Stored<T> VALUE;
+  struct Gather {
+    std::mutex mutex;
+    std::vector<std::optional<VALUE>> values;
+    size_t nRemaining;
+  };
+  TaskFuture<std::vector<VALUE>> result;
+  if (futures.empty()) {
+    result.SetValue({});
+    return result;
+  }
+  auto gather = std::make_shared<Gather>();
+  gather->values.resize(futures.size());
+  gather->nRemaining = futures.size();
+  for (size_t i = 0; i < futures.size(); i++) {
+    const TaskFuture<T>& future = futures[i];
+    future.OnReady([future, gather, result, i]() {
+      std::optional<VALUE> value;  // VALUE may have no default constructor
+      try {
+        value.emplace(future.GetValue());
+      } catch (...) {
+        result.SetException(std::current_exception());
+        return;
+      }
+      std::vector<VALUE> values;
+      {
+        std::lock_guard lock(gather->mutex);
+        gather->values[i] = std::move(value);
+        if (--gather->nRemaining > 0) return;
+        for (auto& v : gather->values) values.push_back(std::move(*v));
+      }
+      result.SetValue(std::move(values));
+    });
+  }
+  return result;
+}
+
+// Future of a tuple of the results of futures of different types.
+template <typename... Ts>
+TaskFuture<std::tuple<task_future_detail::Stored<Ts>...>> WhenAll(const TaskFuture<Ts>&... futures) {
+  typedef std::tuple<task_future_detail::Stored<Ts>...> TUPLE;
+  struct Gather {
+    std::mutex mutex;
+    std::tuple<std::optional<task_future_detail::Stored<Ts>>...> values;
+    size_t nRemaining = sizeof...(Ts);
+  };
+  TaskFuture<TUPLE> result;
+  auto gather = std::make_shared<Gather>();
+  auto attach = [&]<size_t I, typename U>(const TaskFuture<U>& future) {
+    future.OnReady([future, gather, result]() {
+      try {
+        const auto& value = future.GetValue();
+        std::lock_guard lock(gather->mutex);
+        std::get<I>(gather->values).emplace(value);
+        if (--gather->nRemaining > 0) return;
+      } catch (...) {
+        result.SetException(std::current_exception());
+        return;
+      }
+      result.SetValue(std::apply([](auto&... v) { return TUPLE(std::move(*v)...); }, gather->values));
+    });
+  };
+  [&]<size_t... Is>(std::index_sequence<Is...>) {
+    (attach.template operator()<Is>(futures), ...);
+  }(std::index_sequence_for<Ts...>());
+  return result;
+}
+
+// Future of the first result to be set, with the index of its future. If the first input to
+// complete failed, the result gets its exception.
+template <typename T>
+TaskFuture<std::pair<size_t, task_future_detail::Stored<T>>> WhenAny(
+    const std::vector<TaskFuture<T>>& futures) {
+  TaskFuture<std::pair<size_t, task_future_detail::Stored<T>>> result;
+  for (size_t i = 0; i < futures.size(); i++) {
+    const TaskFuture<T>& future = futures[i];
+    // The result ignores everything after the first SetValue or SetException
+    future.OnReady([future, result, i]() {
+      try {
+        result.SetValue({i, future.GetValue()});
+      } catch (...) {
+        result.SetException(std::current_exception());
+      }
+    });
+  }
+  return result;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "task.h"
+#include "threadpool.h"
+
+// Timings of the last TaskGraph::Run().
+struct TaskGraphReport {
+  struct NodeTiming {
+    std::string strName;
+    int64_t nStartNs = 0;     // from the start of Run()
+    int64_t nDurationNs = 0;  // of the node's function
+    bool bCritical = false;   // on the critical path
+  };
+
+  int64_t nWallNs = 0;  // from the start of Run() to the end of the last node
+  // Longest chain of dependent nodes, by measured duration: a lower bound of nWallNs however many
+  // threads run the graph. The rest of nWallNs is waiting for a thread, and scheduling.
+  int64_t nCriticalPathNs = 0;
+  std::vector<size_t> criticalPath;  // node ids, first to last
+  std::vector<NodeTiming> nodes;     // by node id
+
+  // One line per node of the critical path, with its share of the path
+  std::string ToString() const;
+};
+
+// A graph of tasks with dependencies, built once and run many times (e.g. every frame):
+//
+//   TaskGraph graph;
+//   auto input = graph.AddNode("input", [&]() { ReadSensors(); });
+//   auto left = graph.AddNode("left", [&]() { ProcessLeft(); });
+//   auto right = graph.AddNode("right", [&]() { ProcessRight(); });
+//   auto output = graph.AddNode("output", [&]() { Publish(); });
+//   graph.AddDependency(input, left);
+//   graph.AddDependency(input, right);
+//   graph.AddDependency(left, output);
+//   graph.AddDependency(right, output);
+//   while (running) graph.Run(pool);
+//
+// Every node counts its unfinished dependencies in an atomic; the node finishing last pushes it to
+// the pool. Nodes are the pool tasks themselves, so a run allocates nothing.
+class TaskGraph {
+public:
+  typedef size_t NODEID;
+
+  TaskGraph() = default;
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+  NODEID AddNode(const char* szName, std::function<void()> fn);
+
+  // 'after' starts once 'before' has finished.
+  void AddDependency(NODEID before, NODEID after);
+
+  size_t GetNodeCount() const { return m_nodes.size(); }
+
+  // Run every node once, and block until all have finished. Returns false, without running
+  // anything, if the dependencies have a cycle. If nodes throw, the nodes that have not started yet
+  // are skipped and the first exception is rethrown. Not from a worker of 'pool', and not
+  // concurrently with another Run() of the same graph.
+  bool Run(ThreadPool& pool = ThreadPool::GetShared());
+
+  // Timings of the last Run(), with its critical path.
+  TaskGraphReport GetReport() const;
+
+protected:
+  struct Node : public AbstractTask {
+    void Execute() override;
+
+    TaskGraph* pGraph = nullptr;
+    std::string strName;
+    std::function<void()> fn;
+    std::vector<NODEID> successors;
+    int nDependencies = 0;
+    std::atomic<int> nPending{0};
+    int64_t nStartNs = 0;
+    int64_t nEndNs = 0;
+  };
+
+  bool Validate();
+  void NodeDone();
+
+  std::vector<std::unique_ptr<Node>> m_nodes;
+  std::vector<NODEID> m_roots;
+  std::vector<NODEID> m_order;  // topological
+  bool m_bValidated = false;
+  bool m_bAcyclic = false;
+
+  // State of the current run
+  ThreadPool* m_pPool = nullptr;
+  int64_t m_nRunStartNs = 0;
+  std::atomic<size_t> m_nRemaining{0};
+  std::atomic_bool m_bFailed{false};
+  std::exception_ptr m_exception;
+  std::mutex m_mutex;  // guards m_exception and m_bDone
+  std::condition_variable m_doneCondition;
+  bool m_bDone = false;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Recycling allocator for task-sized objects (tasks, coroutine frames), so a steady stream of tasks
+// causes no heap allocation once warmed up.
+//
+// Blocks come in power-of-two size classes up to kMaxBlockSize. Every thread keeps its own free list
+// per size class. A block freed by the thread that allocated it goes back on that thread's list with
+// no atomic operation; a block freed by another thread (the usual case: a producer allocates a task,
+// the consumer runs and frees it) is pushed back to its owner with one CAS, and the owner takes all
+// returned blocks at once when its list runs dry. When a thread exits, its free blocks are released,
+// and blocks still in flight are released by whoever frees them.
+//
+// Larger requests go to the heap.
+class TaskPool {
+public:
+  static constexpr size_t kMaxBlockSize = 4096;
+
+  static void* Allocate(size_t size);
+  static void Free(void* p) noexcept;
+
+  // Blocks obtained from the heap and not yet released, over all threads (for tests and stats).
+  static int64_t GetLiveBlockCount();
+};
@@ -3,11 +3,47 @@
 #include <poll.h>
 #include <sys/types.h>
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <source_location>
+#include <string>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
+#include "latency_histogram.h"
 #include "task.h"
+#include "thread_options.h"
+
+// Statistics of a TaskThread, see TaskThread::EnableStats().
+struct TaskThreadStats {
+  struct TagStats {
+    std::string strTag;  // task name, "file:line" of the PushFunc() call, or "<untagged>"
+    uint64_t nCount = 0;
+    uint64_t nWaitNs = 0;  // total time spent queued
+    uint64_t nRunNs = 0;   // total execution time
+    uint64_t nMaxRunNs = 0;
+  };
+
+  LatencyHistogram::Snapshot queueWait;  // ns from Push() to the start of Execute()
+  LatencyHistogram::Snapshot runTime;    // ns spent in Execute()
+  uint64_t nTasks = 0;                   // tasks run with statistics enabled
+  double dTasksPerSecond = 0;            // nTasks over the time since statistics were first enabled
+  int64_t nQueueDepth = 0;               // tasks pushed and not started, now
+  int64_t nMaxQueueDepth = 0;            // highest depth seen by the thread while enabled
+  std::vector<TagStats> tags;            // by decreasing total execution time
+};
+
+// What Push() does when the queue of a bounded TaskThread is full, see TaskThread::SetCapacity().
+enum TaskOverflowPolicy {
+  TASK_OVERFLOW_BLOCK,        // wait until the consumer makes room
+  TASK_OVERFLOW_REJECT,       // discard the new task
+  TASK_OVERFLOW_DROP_OLDEST,  // queue the new task, and discard the oldest queued one
+};
 
 class TaskThread : public std::thread {
 public:
@@ -18,30 +54,142 @@ public:
   // Start the thread
   virtual void Start(void* pExtra = nullptr);
 
+  // CPU affinity, scheduling class, nice value and stack size for the thread. Call before Start().
+  void SetThreadOptions(const ThreadOptions& options) { m_threadOptions = options; }
+
   // Push tasks for this thread to execute.
   virtual void Push(AbstractTask* pTask);
 
+  // Push unless the queue is full, whatever the overflow policy. Returns false, leaving the task to
+  // the caller, if it is.
+  bool TryPush(AbstractTask* pTask);
+
+  // Push with a priority class. Higher classes run first; within a class, tasks run in push order.
+  void Push(AbstractTask* pTask, TaskPriority nPriority);
+
+  // Push a task that should start before 'deadline', in a priority class. Within their class,
+  // deadline tasks run before the others, earliest deadline first: a deadline does not jump ahead
+  // of higher classes, and aging still applies.
+  void PushWithDeadline(AbstractTask* pTask, std::chrono::steady_clock::time_point deadline,
+                        TaskPriority nPriority = TASK_PRIORITY_HIGH);
+
   // Push lambdas for this thread to execute.
+  // A lambda taking no argument runs in a pooled FuncTask, which deletes itself after running:
+  // no allocation once the pool is warm. A lambda taking the Task<void>* gets a Task<void>, which it
+  // is responsible for (e.g. to re-queue it).
+  // The task is tagged with the location of the call, for the statistics.
   template <typename FunctionType>
-  void PushFunc(FunctionType func) {
-    typedef Task<void> TASKTYPE;
-    AbstractTask* pTask = new TASKTYPE(func);
-    this->Push(pTask);
+  void PushFunc(FunctionType&& func, std::source_location location = std::source_location::current()) {
+    this->Push(MakeFuncTask(std::forward<FunctionType>(func), location));
   }
 
+  template <typename FunctionType>
+  void PushFunc(FunctionType&& func, TaskPriority nPriority,
+                std::source_location location = std::source_location::current()) {
+    this->Push(MakeFuncTask(std::forward<FunctionType>(func), location), nPriority);
+  }
+
+  template <typename FunctionType>
+  void PushFuncWithDeadline(FunctionType&& func, std::chrono::steady_clock::time_point deadline,
+                            TaskPriority nPriority = TASK_PRIORITY_HIGH,
+                            std::source_location location = std::source_location::current()) {
+    this->PushWithDeadline(MakeFuncTask(std::forward<FunctionType>(func), location), deadline, nPriority);
+  }
+
+  // Bound the tasks pushed and not yet started to nCapacity (0: unbounded, the default), so a slow
+  // consumer cannot make the queue grow until memory runs out. When it is full, Push():
+  // - TASK_OVERFLOW_BLOCK: waits for room. A push from the thread itself does not wait, to avoid a
+  //   deadlock, and may exceed the capacity.
+  // - TASK_OVERFLOW_REJECT: discards the new task (AbstractTask::Discard()).
+  // - TASK_OVERFLOW_DROP_OLDEST: the thread discards its oldest tasks, lowest priority class first
+  //   on ties, when it takes new ones, i.e. between two tasks. Deadline tasks are never dropped.
+  //   While the thread runs a long task, up to twice nCapacity tasks queue up; past that, Push()
+  //   discards the new task instead.
+  // Coroutine hops (schedule(), and resuming the awaiting coroutine) are never rejected or dropped:
+  // with REJECT and DROP_OLDEST, they go over capacity instead (see AbstractTask::bDiscardable).
+  void SetCapacity(size_t nCapacity, TaskOverflowPolicy nPolicy = TASK_OVERFLOW_BLOCK);
+  size_t GetCapacity() const { return m_nCapacity.load(std::memory_order_relaxed); }
+  // Tasks pushed and not started, and the most there ever were. Any thread may read. Only counted
+  // while the queue is bounded or statistics are enabled: unbounded pushes share no counter.
+  size_t GetQueueSize() const { return m_nSize.load(std::memory_order_relaxed); }
+  size_t GetHighWaterMark() const { return m_nHighWaterMark.load(std::memory_order_relaxed); }
+  uint64_t GetRejectedCount() const { return m_nRejected.load(std::memory_order_relaxed); }
+  uint64_t GetDroppedCount() const { return m_nDropped.load(std::memory_order_relaxed); }
+
+  // Anti-starvation: a task that has waited longer than 'age' since its push runs before higher
+  // priority classes (oldest first). Only the first task of each queue is aged: the oldest of its
+  // priority class, but for deadline tasks the earliest deadline, which may not be the longest
+  // waiting. 0 disables aging; the default is 250ms.
+  void SetAging(std::chrono::nanoseconds age) { m_nAgingNs = age.count(); }
+
+  // Tasks pushed and not yet started, per priority class and with a deadline. Any thread may read.
+  int64_t GetQueueDepth(TaskPriority nPriority) const;
+  int64_t GetDeadlineQueueDepth() const;
+  // Deadline tasks that started after their deadline.
+  uint64_t GetDeadlineMissCount() const { return m_nDeadlineMisses.load(std::memory_order_relaxed); }
+
+  // Record the queue wait and execution time of every task, per thread and per task tag (see
+  // AbstractTask::szName), the queue depth and the throughput. Disabled, this costs a relaxed load
+  // per push and per task. Statistics accumulate from the first EnableStats(); any thread may call.
+  void EnableStats(bool bEnable = true);
+  bool IsStatsEnabled() const { return m_bStatsEnabled.load(std::memory_order_relaxed); }
+  // Copy of the statistics so far, from any thread. Empty if statistics were never enabled.
+  TaskThreadStats GetStats() const;
+
+  // 'co_await thread.schedule()' continues the coroutine on this thread.
+  ScheduleAwaiter<TaskThread> schedule() { return ScheduleAwaiter<TaskThread>(*this); }
+
+  // The TaskThread whose tasks the calling thread is running (its own thread, or the thread calling
+  // Poll()), or nullptr.
+  static TaskThread* GetCurrent();
+
   // Common Quit for all PrimaryThreads, causes all PrimaryThreads to exit their loop.
   static void SetGlobalQuit(bool bQuit = true);
   static bool GetGlobalQuit();
 
   // You make your own thread loop outside this class, and call Poll() yourself.
   // e.g. an Application Main Thread can Poll() to execute tasks.
+  // Every Poll() executes as many tasks as were pending when it starts, in priority order, as one
+  // batch, then calls IdlePoll().
   virtual void Poll(void* pExtra = nullptr);
 
+  // Bound the work done by one Poll(), so IdlePoll() and the caller's loop keep running under a
+  // flood of tasks: stop the batch after nMaxBatch tasks (0: no limit), or once it has run for
+  // 'budget' (0: no limit). Tasks left over stay queued for the next Poll().
+  void SetBatchLimits(size_t nMaxBatch, std::chrono::nanoseconds budget = std::chrono::nanoseconds(0));
+
 protected:
+  template <typename FunctionType>
+  static AbstractTask* MakeFuncTask(FunctionType&& func, const std::source_location& location) {
+    AbstractTask* pTask;
+    if constexpr (std::is_invocable_v<std::decay_t<FunctionType>&>) {
+      pTask = new FuncTask(std::forward<FunctionType>(func));
+    } else {
+      typedef Task<void> TASKTYPE;
+      pTask = new TASKTYPE(std::forward<FunctionType>(func));
+    }
+    pTask->szName = location.file_name();
+    pTask->nLine = location.line();
+    return pTask;
+  }
+
+  void ExecuteWithStats(AbstractTask* pTask, int64_t nPushedNs);
+
+  // Bounded queue: take a slot for a new task, applying the overflow policy, or give slots back
+  bool Admit(AbstractTask* pTask);
+  bool TryReserve(AbstractTask* pTask, size_t nCapacity);
+  void TakeSlot(AbstractTask* pTask);
+  void NoteSize(size_t nSize);
+  void ReleaseSlot(AbstractTask* pTask);
+  bool DropOldest();
+  void Enqueue(AbstractTask* pTask);
+
   void ThreadProc(void* pExtra);
 
-  // This thread Pops tasks and executes them.
+  // This thread Pops tasks and executes them. Only the thread running Poll() may Pop.
   AbstractTask* Pop();
+  bool HasTasks() const;
+  void TakePushedTasks();
 
   // You override this to customize the thread loop.
   virtual void Run(void* pExtra);
@@ -49,9 +197,19 @@ protected:
   // You override this to implement the thread work.
   virtual void IdlePoll();
 
+  // Sleep until a task is pushed or the global quit is set (or the timeout expires). Wake-ups go
+  // through an eventfd: an idle thread uses no CPU, and wakes up within microseconds.
   void WaitForTask();
   void WaitForTaskTimeoutMs(int milliseconds);
 
+  // Same, also waking up when one of the nFds fds is ready, like poll(). A negative timeout waits
+  // forever. Fills pFds[i].revents and returns the number of those fds that are ready.
+  int WaitForTaskOrFds(pollfd* pFds, size_t nFds, int milliseconds);
+
+  static int CreateWakeFd();
+  // Readable while the global quit is set
+  static int GetGlobalQuitFd();
+
   TaskThread(const char* szName, bool bKey)
       : m_strName(szName) {
     (void)bKey;
@@ -59,18 +217,70 @@ protected:
 
 protected:
   std::string m_strName;
-  TASKQUEUE m_queue;
-  std::mutex m_mutex;
-  std::condition_variable m_condition;
+  ThreadOptions m_threadOptions;
+
+  // Lock-free multi-producer, single-consumer queue of tasks, linked through pNextTask.
+  // Producers push onto m_pPushed (a LIFO stack, one CAS each). The consumer takes the whole
+  // stack at once and sorts it, in push order, into a FIFO list and a heap of deadline tasks per
+  // priority class.
+  struct TaskList {
+    AbstractTask* pHead = nullptr;
+    AbstractTask* pTail = nullptr;
+  };
+  std::atomic<AbstractTask*> m_pPushed{nullptr};
+  TaskList m_lists[TASK_PRIORITY_COUNT];
+  std::vector<AbstractTask*> m_deadlineHeaps[TASK_PRIORITY_COUNT];
+  size_t m_nQueued = 0;  // tasks in m_lists and m_deadlineHeaps
+  int64_t m_nAgingNs = 250000000;
+
+  // Pushed and not started, per priority class, then for deadline tasks
+  std::atomic<int64_t> m_nDepth[TASK_PRIORITY_COUNT + 1] = {};
+  std::atomic<uint64_t> m_nDeadlineMisses{0};
+
+  // Allocated by the first EnableStats(), written by the consumer only
+  struct StatsData;
+  std::atomic_bool m_bStatsEnabled{false};
+  std::atomic<StatsData*> m_pStats{nullptr};
+
+  // Bounded queue
+  std::atomic<size_t> m_nCapacity{0};
+  std::atomic<TaskOverflowPolicy> m_nOverflowPolicy{TASK_OVERFLOW_BLOCK};
+  std::atomic<size_t> m_nSize{0};  // pushed and not started (or dropped)
+  std::atomic<size_t> m_nHighWaterMark{0};
+  std::atomic<uint64_t> m_nRejected{0};
+  std::atomic<uint64_t> m_nDropped{0};
+  std::atomic<int> m_nBlockedProducers{0};
+  std::mutex m_capacityMutex;
+  std::condition_variable m_capacityCondition;
+
+  size_t m_nMaxBatch = SIZE_MAX;
+  int64_t m_nBatchBudgetNs = 0;
+
+  // The consumer sleeps in poll() on m_nWakeFd. Producers write to the eventfd only to wake a
+  // consumer that flagged itself as sleeping.
+  int m_nWakeFd = CreateWakeFd();
+  std::atomic_bool m_bConsumerSleeping{false};
+  std::vector<pollfd> m_pollFds;
 };
 
 typedef TaskThread AppMainThread;
 
 class WorkerThread : public TaskThread {
 public:
+  typedef std::function<void(int fd, short revents)> FDHANDLER;
+
   WorkerThread(const char* szName = "workerthread")
       : TaskThread(szName) {}
 
+  // Call handler on this thread whenever fd is ready for 'events' (POLLIN, POLLOUT...), while the
+  // thread is idle. Only from the thread itself (e.g. in a pushed task), or before Start().
+  void WatchFd(int fd, short events, FDHANDLER handler);
+  void UnwatchFd(int fd);
+
 protected:
   void IdlePoll() override;
+
+  std::vector<pollfd> m_watchedFds;
+  std::vector<FDHANDLER> m_fdHandlers;
+  std::vector<pollfd> m_readyFds;
 };
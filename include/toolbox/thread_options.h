@@ -0,0 +1,50 @@
+#pragma once
+
+#include <sched.h>
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// How a TaskThread or the workers of a ThreadPool are started: which CPUs they may run on, their
+// scheduling class, nice value and stack size. The default leaves everything as inherited.
+struct ThreadOptions {
+  // CPUs the thread may run on; empty for all.
+  std::vector<int> cpus;
+  // For a ThreadPool, pin worker i to cpus[i % cpus.size()] only, instead of allowing the whole set.
+  bool bOneCpuPerThread = false;
+
+  // SCHED_FIFO or SCHED_RR with a priority (clamped to the policy's range, 1..99 on Linux) for
+  // latency-critical threads. Needs CAP_SYS_NICE or an RLIMIT_RTPRIO; without it the thread keeps
+  // its normal scheduling, and a warning is logged.
+  int nSchedPolicy = SCHED_OTHER;
+  int nSchedPriority = 0;
+
+  // Nice value for SCHED_OTHER threads, 0 to keep the inherited one. Raising it (e.g. 10 for bulk
+  // workers) is always allowed; lowering it below the process' needs privileges.
+  int nNice = 0;
+
+  // Stack size in bytes, 0 for the default.
+  size_t nStackSize = 0;
+};
+
+// Apply the CPU set, scheduling class and nice value of 'options' to the calling thread. Failures
+// are logged, and leave the corresponding setting as it was. Returns true if everything applied.
+// nCpuIndex selects the CPU when options.bOneCpuPerThread is set.
+bool ApplyThreadOptions(const ThreadOptions& options, const char* szThreadName, size_t nCpuIndex = 0);
+
+// While in scope, new threads (including std::threads, which take no attributes) get a stack of
+// nStackSize bytes, by changing the process default (a glibc extension). Only one can exist at a
+// time; other threads creating threads meanwhile also get that stack size. 0 changes nothing.
+class ScopedThreadStackSize {
+public:
+  explicit ScopedThreadStackSize(size_t nStackSize);
+  ~ScopedThreadStackSize();
+  ScopedThreadStackSize(const ScopedThreadStackSize&) = delete;
+  ScopedThreadStackSize& operator=(const ScopedThreadStackSize&) = delete;
+
+private:
+  std::unique_lock<std::mutex> m_lock;
+  size_t m_nPreviousSize = 0;
+  bool m_bChanged = false;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "task.h"
+#include "thread_options.h"
+#include "work_stealing_deque.h"
+
+// A pool of worker threads executing AbstractTasks, balanced by work stealing.
+//
+// Every worker owns a Chase-Lev deque. Tasks pushed from a worker thread (e.g. a task fanning out
+// sub-tasks) go to the bottom of that worker's deque and are popped back LIFO, while cache-hot.
+// Tasks pushed from any other thread go to a global injection queue. An idle worker first takes
+// from its own deque, then from the injection queue, then steals the oldest task of randomly
+// chosen victims, so a burst pushed onto one worker spreads over all cores by itself.
+//
+// Like TaskThread, the pool does not own AbstractTasks pushed with Push(); PushFunc() follows the
+// same rules as TaskThread::PushFunc().
+class ThreadPool {
+public:
+  // nThreads == 0 means one thread per hardware thread.
+  ThreadPool(const char* szName = "threadpool", size_t nThreads = 0);
+  virtual ~ThreadPool();
+  const char* GetName() const { return m_strName.c_str(); }
+
+  // Start the worker threads
+  virtual void Start();
+
+  // Options for every worker thread; set ThreadOptions::bOneCpuPerThread to pin worker i to the
+  // i-th CPU of the set. Call before Start().
+  void SetThreadOptions(const ThreadOptions& options) { m_threadOptions = options; }
+
+  // Run all the tasks pushed so far (and the tasks they push), then join the worker threads.
+  void Stop();
+
+  // Push tasks for the pool to execute.
+  void Push(AbstractTask* pTask);
+
+  // Push lambdas for the pool to execute, as with TaskThread::PushFunc.
+  template <typename FunctionType>
+  void PushFunc(FunctionType&& func) {
+    if constexpr (std::is_invocable_v<std::decay_t<FunctionType>&>) {
+      this->Push(new FuncTask(std::forward<FunctionType>(func)));
+    } else {
+      typedef Task<void> TASKTYPE;
+      this->Push(new TASKTYPE(std::forward<FunctionType>(func)));
+    }
+  }
+
+  // 'co_await pool.schedule()' continues the coroutine on one of the workers.
+  ScheduleAwaiter<ThreadPool> schedule() { return ScheduleAwaiter<ThreadPool>(*this); }
+
+  // Block until every task pushed so far, and every task those push, has run, or until
+  // TaskThread::SetGlobalQuit(): the workers then exit and leave the remaining tasks unrun.
+  // Must not be called from a worker thread of this pool.
+  void WaitIdle();
+
+  size_t GetThreadCount() const { return m_workers.size(); }
+
+  // Process-wide pool with one thread per hardware thread, started on first use. The parallel
+  // algorithms (parallel.h) run on it by default.
+  static ThreadPool& GetShared();
+
+  // Index of the calling thread in this pool, or -1 if it is not one of its workers.
+  int GetWorkerIndex() const;
+
+protected:
+  struct Worker {
+    WorkStealingDeque<AbstractTask*> deque;
+    std::thread thread;
+    uint64_t rng = 0;
+  };
+
+  void WorkerProc(size_t index);
+  AbstractTask* FindTask(size_t index);
+  bool HasVisibleWork() const;
+  void Execute(AbstractTask* pTask);
+  void WakeWorker();
+
+  std::string m_strName;
+  ThreadOptions m_threadOptions;
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  bool m_bStarted = false;
+  std::atomic_bool m_bStop{false};
+
+  // Global injection queue, for tasks pushed from outside the pool
+  TASKQUEUE m_queue;
+  std::mutex m_mutex;
+  std::atomic<size_t> m_nQueued{0};
+
+  // Idle workers sleep on this condition
+  std::mutex m_sleepMutex;
+  std::condition_variable m_sleepCondition;
+  std::atomic<int> m_nSleeping{0};
+
+  // Tasks pushed and not yet finished, for WaitIdle()
+  std::atomic<int64_t> m_nPending{0};
+  std::mutex m_idleMutex;
+  std::condition_variable m_idleCondition;
+};
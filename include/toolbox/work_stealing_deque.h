@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Chase-Lev work-stealing deque (Chase & Lev, SPAA 2005), with the memory orderings of
+// Le, Pop, Cohen & Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory Models",
+// PPoPP 2013.
+//
+// One owner thread pushes and pops at the bottom, like a stack, which keeps recently spawned (cache
+// hot) work local. Any number of thief threads steal from the top, oldest first. Owner operations
+// are plain loads and stores except when the deque is down to its last element; a steal is one CAS.
+//
+// T must be trivially copyable and fit in an atomic (typically a pointer). The ring grows when full;
+// old rings are kept until the deque is destroyed because a thief may still be reading one.
+template <typename T>
+class WorkStealingDeque {
+  static_assert(std::is_trivially_copyable_v<T>, "WorkStealingDeque holds trivially copyable items");
+
+  struct Ring {
+    explicit Ring(size_t capacity)
+        : mask(capacity - 1)
+        , items(new std::atomic<T>[capacity]) {}
+
+    size_t capacity() const { return mask + 1; }
+    T get(int64_t i) const { return items[size_t(i) & mask].load(std::memory_order_relaxed); }
+    void put(int64_t i, T value) { items[size_t(i) & mask].store(value, std::memory_order_relaxed); }
+
+    size_t mask;
+    std::unique_ptr<std::atomic<T>[]> items;
+  };
+
+public:
+  explicit WorkStealingDeque(size_t initial_capacity = 256) {
+    size_t capacity = 2;
+    while (capacity < initial_capacity) capacity *= 2;
+    rings_.push_back(std::make_unique<Ring>(capacity));
+    ring_.store(rings_.back().get(), std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  // Owner only.
+  void push(T value) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Ring* ring = ring_.load(std::memory_order_relaxed);
+    if (b - t > int64_t(ring->capacity()) - 1) {
+      ring = grow(ring, t, b);
+    }
+    ring->put(b, value);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only. Returns false if the deque is empty.
+  bool pop(T& value) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Ring* ring = ring_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    value = ring->get(b);
+    if (t == b) {
+      // Last element: race the thieves for it
+      bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // Any thread. Returns false if the deque is empty or another thread took the element first.
+  bool steal(T& value) {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) return false;
+    Ring* ring = ring_.load(std::memory_order_acquire);
+    value = ring->get(t);
+    return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  // Approximate when other threads push or pop concurrently.
+  size_t size() const {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return b > t ? size_t(b - t) : 0;
+  }
+  bool empty() const { return size() == 0; }
+
+private:
+  Ring* grow(Ring* ring, int64_t t, int64_t b) {
+    auto bigger = std::make_unique<Ring>(ring->capacity() * 2);
+    for (int64_t i = t; i < b; i++) {
+      bigger->put(i, ring->get(i));
+    }
+    Ring* r = bigger.get();
+    rings_.push_back(std::move(bigger));
+    ring_.store(r, std::memory_order_release);
+    return r;
+  }
+
+  alignas(64) std::atomic<int64_t> top_{0};
+  alignas(64) std::atomic<int64_t> bottom_{0};
+  std::atomic<Ring*> ring_;
+  std::vector<std::unique_ptr<Ring>> rings_;  // owner only
+};
@@ -0,0 +1,234 @@
+#include "iir_filter_bank.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IIR_FILTER_BANK_X86 1
+#endif
+
+IirSection IirSection::firstOrder(float alpha) {
+  IirSection s;
+  s.type = FIRST_ORDER;
+  s.b0 = alpha;
+  return s;
+}
+
+IirSection IirSection::biquad(float b0, float b1, float b2, float a1, float a2) {
+  IirSection s;
+  s.type = BIQUAD;
+  s.b0 = b0;
+  s.b1 = b1;
+  s.b2 = b2;
+  s.a1 = a1;
+  s.a2 = a2;
+  return s;
+}
+
+IirSection IirSection::lowPass(double cutoff_hz, double sample_rate_hz, double q) {
+  const double w0 = 2.0 * M_PI * cutoff_hz / sample_rate_hz;
+  const double alpha = std::sin(w0) / (2.0 * q);
+  const double cosw = std::cos(w0);
+  const double a0 = 1.0 + alpha;
+  return biquad(float((1.0 - cosw) / 2.0 / a0), float((1.0 - cosw) / a0), float((1.0 - cosw) / 2.0 / a0),
+                float(-2.0 * cosw / a0), float((1.0 - alpha) / a0));
+}
+
+IirSection IirSection::highPass(double cutoff_hz, double sample_rate_hz, double q) {
+  const double w0 = 2.0 * M_PI * cutoff_hz / sample_rate_hz;
+  const double alpha = std::sin(w0) / (2.0 * q);
+  const double cosw = std::cos(w0);
+  const double a0 = 1.0 + alpha;
+  return biquad(float((1.0 + cosw) / 2.0 / a0), float(-(1.0 + cosw) / a0), float((1.0 + cosw) / 2.0 / a0),
+                float(-2.0 * cosw / a0), float((1.0 - alpha) / a0));
+}
+
+double IirSection::dcGain() const {
+  if (type == FIRST_ORDER) return 1.0;
+  double den = 1.0 + double(a1) + double(a2);
+  if (den == 0.0) return 0.0;
+  return (double(b0) + double(b1) + double(b2)) / den;
+}
+
+// Every kernel filters channels [begin, end) through all the sections. Biquads use the transposed
+// direct form II, which needs two state variables per channel:
+//   y = b0 x + s1,  s1 = b1 x - a1 y + s2,  s2 = b2 x - a2 y
+// First-order sections keep the last output as their only state.
+namespace {
+
+struct Frame {
+  const IirSection* sections;
+  const size_t* state_offset;
+  size_t num_sections;
+  size_t stride;
+  float* state;
+  const float* in;
+  float* out;
+};
+
+void filterScalar(const Frame& f, size_t begin, size_t end) {
+  for (size_t c = begin; c < end; c++) {
+    float x = f.in[c];
+    for (size_t k = 0; k < f.num_sections; k++) {
+      const IirSection& s = f.sections[k];
+      float* s1 = f.state + f.state_offset[k] + c;
+      if (s.type == IirSection::FIRST_ORDER) {
+        x = *s1 + s.b0 * (x - *s1);
+        *s1 = x;
+      } else {
+        float* s2 = s1 + f.stride;
+        float y = s.b0 * x + *s1;
+        *s1 = s.b1 * x - s.a1 * y + *s2;
+        *s2 = s.b2 * x - s.a2 * y;
+        x = y;
+      }
+    }
+    f.out[c] = x;
+  }
+}
+
+#ifdef IIR_FILTER_BANK_X86
+// SSE2 is part of x86-64, so this path needs no run-time check. Returns the first channel left for
+// the scalar path.
+size_t filterSse(const Frame& f, size_t end) {
+  size_t c = 0;
+  for (; c + 4 <= end; c += 4) {
+    __m128 x = _mm_loadu_ps(f.in + c);
+    for (size_t k = 0; k < f.num_sections; k++) {
+      const IirSection& s = f.sections[k];
+      float* p1 = f.state + f.state_offset[k] + c;
+      __m128 s1 = _mm_load_ps(p1);
+      if (s.type == IirSection::FIRST_ORDER) {
+        x = _mm_add_ps(s1, _mm_mul_ps(_mm_set1_ps(s.b0), _mm_sub_ps(x, s1)));
+        _mm_store_ps(p1, x);
+      } else {
+        float* p2 = p1 + f.stride;
+        __m128 s2 = _mm_load_ps(p2);
+        __m128 y = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(s.b0), x), s1);
+        s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(s.b1), x), _mm_mul_ps(_mm_set1_ps(s.a1), y)), s2);
+        s2 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(s.b2), x), _mm_mul_ps(_mm_set1_ps(s.a2), y));
+        _mm_store_ps(p1, s1);
+        _mm_store_ps(p2, s2);
+        x = y;
+      }
+    }
+    _mm_storeu_ps(f.out + c, x);
+  }
+  return c;
+}
+
+__attribute__((target("avx2,fma"))) size_t filterAvx2(const Frame& f, size_t end) {
+  size_t c = 0;
+  for (; c + 8 <= end; c += 8) {
+    __m256 x = _mm256_loadu_ps(f.in + c);
+    for (size_t k = 0; k < f.num_sections; k++) {
+      const IirSection& s = f.sections[k];
+      float* p1 = f.state + f.state_offset[k] + c;
+      __m256 s1 = _mm256_load_ps(p1);
+      if (s.type == IirSection::FIRST_ORDER) {
+        x = _mm256_fmadd_ps(_mm256_set1_ps(s.b0), _mm256_sub_ps(x, s1), s1);
+        _mm256_store_ps(p1, x);
+      } else {
+        float* p2 = p1 + f.stride;
+        __m256 s2 = _mm256_load_ps(p2);
+        __m256 y = _mm256_fmadd_ps(_mm256_set1_ps(s.b0), x, s1);
+        s1 = _mm256_fmadd_ps(_mm256_set1_ps(s.b1), x, _mm256_fnmadd_ps(_mm256_set1_ps(s.a1), y, s2));
+        s2 = _mm256_fnmadd_ps(_mm256_set1_ps(s.a2), y, _mm256_mul_ps(_mm256_set1_ps(s.b2), x));
+        _mm256_store_ps(p1, s1);
+        _mm256_store_ps(p2, s2);
+        x = y;
+      }
+    }
+    _mm256_storeu_ps(f.out + c, x);
+  }
+  // Up to 7 channels left: one SSE step can still take 4 of them
+  return c + filterSse(Frame{f.sections, f.state_offset, f.num_sections, f.stride, f.state + c, f.in + c,
+                             f.out + c},
+                       end - c);
+}
+#endif
+
+}  // namespace
+
+IirFilterBank::IirFilterBank(size_t num_channels, float alpha)
+    : IirFilterBank(num_channels, std::vector<IirSection>{IirSection::firstOrder(alpha)}) {}
+
+IirFilterBank::IirFilterBank(size_t num_channels, std::vector<IirSection> sections)
+    : num_channels_(num_channels)
+    , stride_((num_channels + 7) & ~size_t(7))
+    , sections_(std::move(sections))
+    , isa_(bestIsa()) {
+  size_t rows = 0;
+  for (const auto& s : sections_) {
+    state_offset_.push_back(rows * stride_);
+    rows += s.type == IirSection::BIQUAD ? 2 : 1;
+  }
+  // aligned_alloc needs a size that is a multiple of the alignment; stride_ is a multiple of 8 floats
+  const size_t bytes = std::max<size_t>(rows * stride_, 8) * sizeof(float);
+  state_.reset(static_cast<float*>(std::aligned_alloc(32, bytes)));
+  if (!state_) throw std::bad_alloc();
+  std::memset(state_.get(), 0, bytes);
+}
+
+IirFilterBank::Isa IirFilterBank::bestIsa() {
+#ifdef IIR_FILTER_BANK_X86
+  static const Isa best =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? ISA_AVX2 : ISA_SSE;
+  return best;
+#else
+  return ISA_SCALAR;
+#endif
+}
+
+void IirFilterBank::setIsa(Isa isa) { isa_ = std::min(isa, bestIsa()); }
+
+void IirFilterBank::update(const float* in, float* out) noexcept {
+  const Frame f{sections_.data(), state_offset_.data(), sections_.size(), stride_, state_.get(), in, out};
+  size_t done = 0;
+#ifdef IIR_FILTER_BANK_X86
+  if (isa_ == ISA_AVX2) {
+    done = filterAvx2(f, num_channels_);
+  } else if (isa_ == ISA_SSE) {
+    done = filterSse(f, num_channels_);
+  }
+#endif
+  filterScalar(f, done, num_channels_);
+}
+
+void IirFilterBank::update(std::span<const float> in, std::span<float> out) noexcept {
+  assert(in.size() >= num_channels_ && out.size() >= num_channels_);
+  update(in.data(), out.data());
+}
+
+void IirFilterBank::reset(float value) noexcept {
+  for (size_t c = 0; c < num_channels_; c++) {
+    resetChannel(c, value);
+  }
+}
+
+void IirFilterBank::reset(const float* values) noexcept {
+  for (size_t c = 0; c < num_channels_; c++) {
+    resetChannel(c, values[c]);
+  }
+}
+
+void IirFilterBank::resetChannel(size_t c, float x) noexcept {
+  for (size_t k = 0; k < sections_.size(); k++) {
+    const IirSection& s = sections_[k];
+    float* s1 = state_.get() + state_offset_[k] + c;
+    if (s.type == IirSection::FIRST_ORDER) {
+      *s1 = x;
+    } else {
+      // Steady state of the transposed direct form II for a constant input x
+      float* s2 = s1 + stride_;
+      float y = float(s.dcGain() * double(x));
+      *s2 = s.b2 * x - s.a2 * y;
+      *s1 = s.b1 * x - s.a1 * y + *s2;
+      x = y;
+    }
+  }
+}
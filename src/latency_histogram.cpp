@@ -0,0 +1,165 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram(uint64_t highest_trackable, int sub_bucket_bits)
+    : sub_bucket_bits_(std::clamp(sub_bucket_bits, 2, 20))
+    , sub_bucket_count_(uint64_t(1) << sub_bucket_bits_)
+    , half_count_(sub_bucket_count_ / 2)
+    , num_buckets_(SIZE_MAX) {
+  num_buckets_ = bucketIndex(std::max(highest_trackable, sub_bucket_count_)) + 1;
+  counts_ = std::make_unique<std::atomic<uint64_t>[]>(num_buckets_);
+  for (size_t i = 0; i < num_buckets_; i++) {
+    counts_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t LatencyHistogram::bucketLowest(size_t index, int sub_bucket_bits) noexcept {
+  const uint64_t sub_bucket_count = uint64_t(1) << sub_bucket_bits;
+  const uint64_t half_count = sub_bucket_count / 2;
+  if (index < sub_bucket_count) return index;
+  uint64_t j = index - sub_bucket_count;
+  uint64_t exponent = j / half_count + 1;
+  uint64_t mantissa = j % half_count + half_count;
+  return mantissa << exponent;
+}
+
+uint64_t LatencyHistogram::bucketHighest(size_t index, int sub_bucket_bits) noexcept {
+  const uint64_t sub_bucket_count = uint64_t(1) << sub_bucket_bits;
+  const uint64_t half_count = sub_bucket_count / 2;
+  if (index < sub_bucket_count) return index;
+  uint64_t j = index - sub_bucket_count;
+  uint64_t exponent = j / half_count + 1;
+  uint64_t mantissa = j % half_count + half_count;
+  return ((mantissa + 1) << exponent) - 1;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot s;
+  s.sub_bucket_bits_ = sub_bucket_bits_;
+  s.counts_.resize(num_buckets_);
+  for (size_t i = 0; i < num_buckets_; i++) {
+    s.counts_[i] = counts_[i].load(std::memory_order_relaxed);
+    s.count_ += s.counts_[i];
+  }
+  s.sum_ = sum_.load(std::memory_order_relaxed);
+  s.min_ = min_.load(std::memory_order_relaxed);
+  s.max_ = max_.load(std::memory_order_relaxed);
+  return s;
+}
+
+void LatencyHistogram::reset() noexcept {
+  for (size_t i = 0; i < num_buckets_; i++) {
+    counts_[i].store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  min_.store(UINT64_MAX, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Snapshot::getPercentile(double q) const noexcept {
+  if (count_ == 0) return 0;
+  if (q <= 0.0) return min();
+  if (q >= 1.0) return max_;
+  const double rank = q * double(count_ - 1);
+  uint64_t n = 0;
+  for (size_t i = 0; i < counts_.size(); i++) {
+    n += counts_[i];
+    if (double(n) > rank) {
+      uint64_t lo = LatencyHistogram::bucketLowest(i, sub_bucket_bits_);
+      uint64_t hi = LatencyHistogram::bucketHighest(i, sub_bucket_bits_);
+      return std::clamp(lo + (hi - lo) / 2, min(), max_);
+    }
+  }
+  return max_;
+}
+
+bool LatencyHistogram::Snapshot::merge(const Snapshot& other) {
+  if (other.counts_.empty()) return true;
+  if (counts_.empty()) {
+    *this = other;
+    return true;
+  }
+  if (other.sub_bucket_bits_ != sub_bucket_bits_) return false;
+  if (other.counts_.size() > counts_.size()) counts_.resize(other.counts_.size(), 0);
+  for (size_t i = 0; i < other.counts_.size(); i++) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  return true;
+}
+
+static std::atomic<uint64_t> next_recorder_id_(1);
+
+LatencyRecorder::LatencyRecorder(uint64_t highest_trackable, int sub_bucket_bits)
+    : id_(next_recorder_id_.fetch_add(1, std::memory_order_relaxed))
+    , highest_trackable_(highest_trackable)
+    , sub_bucket_bits_(sub_bucket_bits) {}
+
+LatencyRecorder::~LatencyRecorder() {}
+
+namespace {
+// Small per-thread cache mapping recorder id -> this thread's histogram in that recorder, backed by
+// the complete per-thread index, sorted by id, for the recorders that collide in the cache.
+// Ids are never reused, so a stale entry from a destroyed recorder can never match.
+struct RecorderCacheEntry {
+  uint64_t id = 0;
+  LatencyHistogram* histogram = nullptr;
+};
+constexpr size_t kRecorderCacheSize = 4;
+thread_local RecorderCacheEntry recorder_cache_[kRecorderCacheSize];
+thread_local std::vector<RecorderCacheEntry> recorder_index_;
+}  // namespace
+
+LatencyHistogram& LatencyRecorder::local() {
+  RecorderCacheEntry& e = recorder_cache_[id_ % kRecorderCacheSize];
+  if (e.id == id_) return *e.histogram;
+  return localSlow();
+}
+
+LatencyHistogram& LatencyRecorder::localSlow() {
+  auto it = std::lower_bound(recorder_index_.begin(), recorder_index_.end(), id_,
+                             [](const RecorderCacheEntry& e, uint64_t id) { return e.id < id; });
+  LatencyHistogram* h = it != recorder_index_.end() && it->id == id_ ? it->histogram : nullptr;
+  if (!h) {
+    // First record() from this thread: the only one to take the lock
+    std::thread::id self = std::this_thread::get_id();
+    std::lock_guard lock(mutex_);
+    for (auto& [tid, hist] : histograms_) {
+      if (tid == self) {
+        h = hist.get();
+        break;
+      }
+    }
+    if (!h) {
+      histograms_.emplace_back(self,
+                               std::make_unique<LatencyHistogram>(highest_trackable_, sub_bucket_bits_));
+      h = histograms_.back().second.get();
+    }
+    recorder_index_.insert(it, {id_, h});
+  }
+  RecorderCacheEntry& e = recorder_cache_[id_ % kRecorderCacheSize];
+  e.id = id_;
+  e.histogram = h;
+  return *h;
+}
+
+LatencyHistogram::Snapshot LatencyRecorder::snapshot() const {
+  LatencyHistogram::Snapshot total;
+  std::lock_guard lock(mutex_);
+  for (const auto& entry : histograms_) {
+    total.merge(entry.second->snapshot());
+  }
+  return total;
+}
+
+void LatencyRecorder::reset() {
+  std::lock_guard lock(mutex_);
+  for (auto& entry : histograms_) {
+    entry.second->reset();
+  }
+}
@@ -1,48 +1,101 @@
 #include "rate.h"
 
+#include <cmath>
+
 void Rate::addPoint(size_t num, double t) {
+  updateEwma(num, t);
   if (num != prev_change_.num || prev_change_.t < 0) {
     struct Change c = {num, t};
+    if (window_count_ == array_size_) {
+      // The slot we are about to overwrite is the oldest change in the window
+      num_sum_ -= changes_[window_start_].num;
+      t_sum_ -= changes_[window_start_].t - t_base_;
+      window_start_ = loopedIndex(window_start_ + 1);
+      window_count_--;
+    }
+    if (window_count_ == 0) {
+      t_base_ = c.t;
+    }
     changes_[current_index_] = c;
+    num_sum_ += c.num;
+    t_sum_ += c.t - t_base_;
+    window_count_++;
     current_index_++;
     current_index_ = loopedIndex(current_index_);
     prev_change_ = c;
+
+    // Keep only one change older than the window: drop the oldest while the next one is
+    // already out of the window (and is not the latest change).
+    while (window_count_ > 2) {
+      const Change& next = changes_[loopedIndex(window_start_ + 1)];
+      if (c.t - next.t < window_seconds_) break;
+      num_sum_ -= changes_[window_start_].num;
+      t_sum_ -= changes_[window_start_].t - t_base_;
+      window_start_ = loopedIndex(window_start_ + 1);
+      window_count_--;
+    }
+
+    // Once per trip around the array, recompute the sums to avoid accumulating rounding errors
     if (current_index_ == 0) {
-      filled_ = true;
+      recomputeSums();
     }
   }
 }
+
+// The rate is sum(num_latest - num_i) / sum(t_latest - t_i) over the changes i in the window,
+// computed from the running sums as (k * num_latest - sum(num_i)) / (k * t_latest - sum(t_i)).
 double Rate::getRate(bool no_divide_by_zero) const {
-  int cur_index = current_index_ - 1;  // index of last element
-  cur_index = loopedIndex(cur_index);
-  int index = cur_index;
-  if (index == 0 && !filled_) {
+  if (window_count_ < 2) {
     return 0.0;  // same num
   }
-  double now = 0.0;
-  double now_sum = 0.0;
-  double rate = 0.0;
+  const Change& latest = changes_[loopedIndex(current_index_ - 1)];
   const double epsilon = 1e-6;
-  while (now < window_seconds_) {
-    // loop through changes
-    index--;  // Go to previous index
-    index = loopedIndex(index);
-
-    if (index == cur_index || (!filled_ && index == array_size_ - 1)) {
-      if (no_divide_by_zero && now_sum > -epsilon && now_sum < epsilon) {
-        return 0.0;
-      }
-      return rate / now_sum;
-    }
-    rate += double(changes_[cur_index].num - changes_[index].num);
-    now = changes_[cur_index].t - changes_[index].t;  // do next now
-    now_sum += now;
-  }
-  if (no_divide_by_zero && now_sum > -epsilon && now_sum < epsilon) {
+  double num_diff = double(size_t(window_count_) * latest.num - num_sum_);
+  double t_diff = double(window_count_) * (latest.t - t_base_) - t_sum_;
+  if (no_divide_by_zero && t_diff > -epsilon && t_diff < epsilon) {
     return 0.0;
   }
-  rate /= now_sum;
-  return rate;
+  return num_diff / t_diff;
+}
+
+void Rate::recomputeSums() {
+  t_base_ = changes_[window_start_].t;
+  num_sum_ = 0;
+  t_sum_ = 0;
+  for (int i = 0; i < window_count_; i++) {
+    const Change& c = changes_[loopedIndex(window_start_ + i)];
+    num_sum_ += c.num;
+    t_sum_ += c.t - t_base_;
+  }
+}
+
+// Exponentially weighted moving averages of the instantaneous rate, with time constants of 1, 10
+// and 60 seconds. Unlike the window, these decay while the counter does not change.
+static constexpr double time_constants[Rate::EWMA_COUNT] = {1.0, 10.0, 60.0};
+
+void Rate::updateEwma(size_t num, double t) {
+  if (ewma_prev_.t < 0) {
+    ewma_prev_ = {num, t};
+    return;
+  }
+  double dt = t - ewma_prev_.t;
+  if (dt <= 0) {
+    return;  // accumulate the counts until time moves forward
+  }
+  double instant = double(num - ewma_prev_.num) / dt;
+  for (int i = 0; i < EWMA_COUNT; i++) {
+    ewma_[i] += (1.0 - std::exp(-dt / time_constants[i])) * (instant - ewma_[i]);
+  }
+  ewma_prev_ = {num, t};
+}
+
+double Rate::getEwmaRate(EwmaWindow window, double t) const {
+  double dt = t - ewma_prev_.t;
+  if (ewma_prev_.t < 0 || dt <= 0) {
+    return ewma_[window];
+  }
+  // What updateEwma() would do with a point of the same num at time t
+  return ewma_[window] * std::exp(-dt / time_constants[window]);
 }
 
 int Rate::loopedIndex(int index) const { return (index % array_size_ + array_size_) % array_size_; }
@@ -0,0 +1,103 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+int64_t TokenBucket::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static int64_t sleepUntil(int64_t wait_ns) {
+  if (wait_ns > 0) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(wait_ns));
+  }
+  return std::max<int64_t>(wait_ns, 0);
+}
+
+// Slower rates (0 and NaN included, which are errors) allow one operation every 31 years, so that
+// the nanosecond arithmetic stays finite
+static constexpr double kMinRate = 1e-9;
+
+static double checkedRate(double rate) {
+  assert(rate > 0.0);
+  return rate > kMinRate ? rate : kMinRate;
+}
+
+// Saturated at 31 years: a huge burst at a slow rate would overflow std::llround()
+static int64_t toNs(double ns) { return int64_t(std::llround(std::min(ns, 1e18))); }
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : ns_per_token_(1e9 / checkedRate(rate))
+    , burst_(std::max(burst, 1.0))
+    , burst_ns_(toNs(burst_ * ns_per_token_))
+    , empty_at_ns_(now() - burst_ns_) {}
+
+bool TokenBucket::tryAcquire(double n, int64_t now_ns) {
+  const int64_t cost = int64_t(std::llround(n * ns_per_token_));
+  int64_t empty_at = empty_at_ns_.load(std::memory_order_relaxed);
+  do {
+    // A full bucket holds at most 'burst' tokens
+    int64_t next = std::max(empty_at, now_ns - burst_ns_) + cost;
+    if (next > now_ns) {
+      return false;
+    }
+    if (empty_at_ns_.compare_exchange_weak(empty_at, next, std::memory_order_acq_rel,
+                                           std::memory_order_relaxed)) {
+      return true;
+    }
+  } while (true);
+}
+
+int64_t TokenBucket::reserve(double n, int64_t now_ns) {
+  const int64_t cost = int64_t(std::llround(n * ns_per_token_));
+  int64_t empty_at = empty_at_ns_.load(std::memory_order_relaxed);
+  int64_t next;
+  do {
+    next = std::max(empty_at, now_ns - burst_ns_) + cost;
+  } while (!empty_at_ns_.compare_exchange_weak(empty_at, next, std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+  return std::max<int64_t>(next - now_ns, 0);
+}
+
+int64_t TokenBucket::acquire(double n) { return sleepUntil(reserve(n, now())); }
+
+double TokenBucket::available(int64_t now_ns) const {
+  int64_t empty_at = empty_at_ns_.load(std::memory_order_relaxed);
+  return std::min(double(now_ns - empty_at) / ns_per_token_, burst_);
+}
+
+GcraLimiter::GcraLimiter(double rate, double burst)
+    : emission_interval_ns_(1e9 / checkedRate(rate))
+    , tolerance_ns_(toNs(std::max(burst, 1.0) * emission_interval_ns_))
+    , tat_ns_(TokenBucket::now()) {}
+
+bool GcraLimiter::tryAcquire(double n, int64_t now_ns) {
+  const int64_t increment = int64_t(std::llround(n * emission_interval_ns_));
+  int64_t tat = tat_ns_.load(std::memory_order_relaxed);
+  do {
+    int64_t new_tat = std::max(tat, now_ns) + increment;
+    if (new_tat - now_ns > tolerance_ns_) {
+      return false;
+    }
+    if (tat_ns_.compare_exchange_weak(tat, new_tat, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+      return true;
+    }
+  } while (true);
+}
+
+int64_t GcraLimiter::reserve(double n, int64_t now_ns) {
+  const int64_t increment = int64_t(std::llround(n * emission_interval_ns_));
+  int64_t tat = tat_ns_.load(std::memory_order_relaxed);
+  int64_t new_tat;
+  do {
+    new_tat = std::max(tat, now_ns) + increment;
+  } while (!tat_ns_.compare_exchange_weak(tat, new_tat, std::memory_order_acq_rel, std::memory_order_relaxed));
+  return std::max<int64_t>(new_tat - now_ns - tolerance_ns_, 0);
+}
+
+int64_t GcraLimiter::acquire(double n) { return sleepUntil(reserve(n, TokenBucket::now())); }
@@ -0,0 +1,126 @@
+#include "rate_table.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+RateTable::RateTable(double window_seconds, size_t num_ids, int num_buckets)
+    : window_seconds_(window_seconds)
+    , num_buckets_(std::max(num_buckets, 2))
+    , times_(size_t(num_buckets_), 0.0) {
+  // The ring must reach back at least a full window
+  bucket_seconds_ = window_seconds_ / double(num_buckets_ - 1);
+  resize(num_ids);
+}
+
+void RateTable::resize(size_t num_ids) {
+  size_t stride = (num_ids + 7) & ~size_t(7);
+  if (stride != stride_) {
+    std::vector<double> counts(size_t(num_buckets_) * stride, 0.0);
+    size_t keep = std::min(stride, stride_);
+    for (int b = 0; b < num_buckets_; b++) {
+      if (keep) memcpy(counts.data() + size_t(b) * stride, row(b), keep * sizeof(double));
+    }
+    counts_.swap(counts);
+    stride_ = stride;
+  }
+  seen_.resize(num_ids, 0);
+  num_ids_ = num_ids;
+}
+
+// Open a new bucket if the current one is old enough. The new bucket starts as a copy of the
+// current one: counters are unchanged until updated.
+void RateTable::advance(double t) {
+  if (used_ == 0) {
+    used_ = 1;
+    current_start_ = t;
+    return;
+  }
+  if (t - current_start_ < bucket_seconds_) {
+    return;
+  }
+  int next = (current_ + 1) % num_buckets_;
+  memcpy(row(next), row(current_), stride_ * sizeof(double));
+  current_ = next;
+  used_ = std::min(used_ + 1, num_buckets_);
+  current_start_ = t;
+}
+
+size_t RateTable::addPoints(const uint32_t* ids, const size_t* nums, size_t count, double t) {
+  // Grow to the highest id below max_ids_; ids past both are ignored below
+  size_t num_ids = num_ids_;
+  for (size_t i = 0; i < count; i++) {
+    if (ids[i] >= num_ids && ids[i] < max_ids_) num_ids = size_t(ids[i]) + 1;
+  }
+  if (num_ids > num_ids_) {
+    resize(num_ids);
+  }
+  advance(t);
+  times_[size_t(current_)] = t;
+
+  size_t ignored = 0;
+  double* cur = row(current_);
+  for (size_t i = 0; i < count; i++) {
+    uint32_t id = ids[i];
+    if (id >= num_ids_) {
+      ignored++;
+      continue;
+    }
+    double num = double(nums[i]);
+    if (!seen_[id]) {
+      // First point: the counter had this value all along, no rate yet
+      for (int b = 0; b < num_buckets_; b++) {
+        row(b)[id] = num;
+      }
+      seen_[id] = 1;
+    }
+    cur[id] = num;
+  }
+  return ignored;
+}
+
+size_t RateTable::addPoints(std::span<const uint32_t> ids, std::span<const size_t> nums, double t) {
+  assert(ids.size() == nums.size());
+  return addPoints(ids.data(), nums.data(), std::min(ids.size(), nums.size()), t);
+}
+
+// Like Rate, the base is the newest bucket that is at least a window old (so the span covers the
+// whole window), or the oldest bucket if the data does not reach that far back.
+int RateTable::baseBucket(double& dt) const {
+  const double latest = times_[size_t(current_)];
+  int base = current_;
+  for (int i = 1; i < used_; i++) {
+    base = (current_ - i + num_buckets_) % num_buckets_;
+    if (latest - times_[size_t(base)] >= window_seconds_) {
+      break;
+    }
+  }
+  dt = latest - times_[size_t(base)];
+  return base;
+}
+
+double RateTable::getRate(uint32_t id) const {
+  if (id >= num_ids_) return 0.0;
+  double dt;
+  int base = baseBucket(dt);
+  const double epsilon = 1e-6;
+  if (dt < epsilon) return 0.0;
+  return (row(current_)[id] - row(base)[id]) / dt;
+}
+
+void RateTable::getRates(double* out) const {
+  double dt;
+  int base = baseBucket(dt);
+  const double epsilon = 1e-6;
+  const double inv_dt = dt < epsilon ? 0.0 : 1.0 / dt;
+  const double* __restrict latest = row(current_);
+  const double* __restrict oldest = row(base);
+  for (size_t i = 0; i < num_ids_; i++) {
+    out[i] = (latest[i] - oldest[i]) * inv_dt;
+  }
+}
+
+void RateTable::getRates(std::vector<double>& out) const {
+  out.resize(num_ids_);
+  getRates(out.data());
+}
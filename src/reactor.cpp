@@ -0,0 +1,241 @@
+#include "reactor.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "vlog.h"
+
+Reactor::Reactor(const char* szName)
+    : TaskThread(szName) {
+  m_events.resize(64);
+  const int nEpollFd = m_pShared->nEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (nEpollFd < 0) {
+    vlog_error(VCAT_GENERAL, "Reactor %s could not create its epoll fd: %s", szName, strerror(errno));
+    return;
+  }
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = kWakeId;
+  if (m_nWakeFd >= 0) epoll_ctl(nEpollFd, EPOLL_CTL_ADD, m_nWakeFd, &event);
+  event.data.u64 = kQuitId;
+  epoll_ctl(nEpollFd, EPOLL_CTL_ADD, GetGlobalQuitFd(), &event);
+}
+
+// Handlers still queued on other threads hold the entries and the shared state: deactivated, they
+// skip their handler and re-arm nothing.
+Reactor::~Reactor() {
+  std::lock_guard lock(m_pShared->mutex);
+  for (auto& [nId, pEntry] : m_entries) {
+    pEntry->bActive = false;
+    if (pEntry->bTimer) close(pEntry->fd);
+  }
+  if (m_pShared->nEpollFd >= 0) close(m_pShared->nEpollFd);
+  m_pShared->nEpollFd = -1;
+}
+
+bool Reactor::Register(uint64_t nId, ENTRYPTR pEntry) {
+  epoll_event event = {};
+  event.events = pEntry->nEvents | (pEntry->bOneShot ? uint32_t(EPOLLONESHOT) : 0);
+  event.data.u64 = nId;
+  if (epoll_ctl(m_pShared->nEpollFd, EPOLL_CTL_ADD, pEntry->fd, &event) < 0) {
+    vlog_error(VCAT_GENERAL, "Reactor %s could not watch fd %d: %s", m_strName.c_str(), pEntry->fd,
+               strerror(errno));
+    return false;
+  }
+  m_entries.emplace(nId, std::move(pEntry));
+  return true;
+}
+
+bool Reactor::AddFd(int fd, uint32_t events, FDHANDLER handler, TaskThread* pThread) {
+  auto pEntry = std::make_shared<Entry>();
+  pEntry->fd = fd;
+  pEntry->nEvents = events;
+  pEntry->fdHandler = std::move(handler);
+  pEntry->pThread = pThread == this ? nullptr : pThread;
+  pEntry->bOneShot = pEntry->pThread && !(events & EPOLLET);
+  std::lock_guard lock(m_pShared->mutex);
+  if (m_fdIds.count(fd)) return false;
+  const uint64_t nId = m_nNextId++;
+  if (!Register(nId, std::move(pEntry))) return false;
+  m_fdIds[fd] = nId;
+  return true;
+}
+
+bool Reactor::ModifyFd(int fd, uint32_t events) {
+  std::lock_guard lock(m_pShared->mutex);
+  auto it = m_fdIds.find(fd);
+  if (it == m_fdIds.end()) return false;
+  Entry& entry = *m_entries[it->second];
+  // The handler's thread decides the mode, as in AddFd()
+  entry.nEvents = events;
+  entry.bOneShot = entry.pThread && !(events & EPOLLET);
+  epoll_event event = {};
+  event.events = events | (entry.bOneShot ? uint32_t(EPOLLONESHOT) : 0);
+  event.data.u64 = it->second;
+  return epoll_ctl(m_pShared->nEpollFd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void Reactor::RemoveFd(int fd) {
+  std::lock_guard lock(m_pShared->mutex);
+  auto it = m_fdIds.find(fd);
+  if (it == m_fdIds.end()) return;
+  const uint64_t nId = it->second;
+  m_fdIds.erase(it);
+  Remove(nId);
+}
+
+// Called with m_pShared->mutex held
+void Reactor::Remove(uint64_t nId) {
+  auto it = m_entries.find(nId);
+  if (it == m_entries.end()) return;
+  Entry& entry = *it->second;
+  entry.bActive = false;
+  epoll_ctl(m_pShared->nEpollFd, EPOLL_CTL_DEL, entry.fd, nullptr);
+  if (entry.bTimer) close(entry.fd);
+  m_entries.erase(it);
+}
+
+int64_t Reactor::AddTimer(std::chrono::nanoseconds delay, std::chrono::nanoseconds period,
+                          TIMERHANDLER handler, TaskThread* pThread) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    vlog_error(VCAT_GENERAL, "Reactor %s could not create a timerfd: %s", m_strName.c_str(), strerror(errno));
+    return -1;
+  }
+  auto toTimespec = [](std::chrono::nanoseconds ns) {
+    timespec ts;
+    ts.tv_sec = time_t(ns.count() / 1000000000);
+    ts.tv_nsec = long(ns.count() % 1000000000);
+    return ts;
+  };
+  itimerspec spec;
+  // A zero it_value would disarm the timer: expire as soon as possible instead
+  spec.it_value = toTimespec(std::max(delay, std::chrono::nanoseconds(1)));
+  spec.it_interval = toTimespec(period);
+  if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+    vlog_error(VCAT_GENERAL, "Reactor %s could not arm a timerfd: %s", m_strName.c_str(), strerror(errno));
+    close(fd);
+    return -1;
+  }
+  auto pEntry = std::make_shared<Entry>();
+  pEntry->fd = fd;
+  pEntry->nEvents = EPOLLIN;
+  pEntry->bTimer = true;
+  pEntry->timerHandler = std::move(handler);
+  pEntry->pThread = pThread == this ? nullptr : pThread;
+  std::lock_guard lock(m_pShared->mutex);
+  const uint64_t nId = m_nNextId++;
+  if (!Register(nId, std::move(pEntry))) {
+    close(fd);
+    return -1;
+  }
+  return int64_t(nId);
+}
+
+void Reactor::RemoveTimer(int64_t nTimerId) {
+  std::lock_guard lock(m_pShared->mutex);
+  auto it = m_entries.find(uint64_t(nTimerId));
+  if (it != m_entries.end() && it->second->bTimer) Remove(uint64_t(nTimerId));
+}
+
+size_t Reactor::GetFdCount() const {
+  std::lock_guard lock(m_pShared->mutex);
+  return m_fdIds.size();
+}
+
+// After a discarded handler, edge-triggered fds are re-armed too: EPOLL_CTL_MOD reports them again
+// if they are still ready, so the data the handler did not read is not forgotten.
+void Reactor::Rearm(Shared& shared, uint64_t nId, const Entry& entry, bool bDiscarded) {
+  std::lock_guard lock(shared.mutex);
+  // Once removed, the fd may already be watched again, under another id
+  if (!entry.bActive || !(entry.bOneShot || bDiscarded) || shared.nEpollFd < 0) return;
+  epoll_event event = {};
+  event.events = entry.nEvents | (entry.bOneShot ? uint32_t(EPOLLONESHOT) : 0);
+  event.data.u64 = nId;
+  epoll_ctl(shared.nEpollFd, EPOLL_CTL_MOD, entry.fd, &event);
+}
+
+void Reactor::Dispatch(uint64_t nId, uint32_t nEvents) {
+  ENTRYPTR pEntry;
+  {
+    std::lock_guard lock(m_pShared->mutex);
+    auto it = m_entries.find(nId);
+    if (it == m_entries.end()) return;
+    pEntry = it->second;
+  }
+  if (pEntry->bTimer) {
+    // Consume the expirations here, or the timerfd stays readable
+    uint64_t nExpirations = 0;
+    if (read(pEntry->fd, &nExpirations, sizeof(nExpirations)) <= 0) return;
+    if (!pEntry->pThread) {
+      pEntry->timerHandler();
+    } else {
+      pEntry->pThread->PushFunc([pEntry]() {
+        if (pEntry->bActive) pEntry->timerHandler();
+      });
+    }
+    return;
+  }
+  if (!pEntry->pThread) {
+    pEntry->fdHandler(pEntry->fd, nEvents);
+    return;
+  }
+  pEntry->pThread->Push(new HandlerTask(m_pShared, pEntry, nId, nEvents));
+}
+
+void Reactor::HandlerTask::Execute() {
+  if (pEntry->bActive) {
+    pEntry->fdHandler(pEntry->fd, nEvents);
+    Rearm(*pShared, nId, *pEntry, false);
+  }
+  delete this;
+}
+
+// Rejected or dropped by a bounded thread: the handler did not run, but the fd must still be
+// reported again.
+void Reactor::HandlerTask::Discard() {
+  Rearm(*pShared, nId, *pEntry, true);
+  delete this;
+}
+
+// Sleep in epoll_wait() until a task is pushed, the global quit is set, or fds are ready, then run
+// their handlers.
+void Reactor::IdlePoll() {
+  // No epoll fd: epoll_wait() would fail at once, sleep like a WorkerThread instead
+  if (m_pShared->nEpollFd < 0) {
+    WaitForTask();
+    return;
+  }
+  int nTimeoutMs = -1;
+  // Without an eventfd, pushes cannot wake us: poll at the old 100ms period
+  if (m_nWakeFd < 0) nTimeoutMs = 100;
+
+  // Same protocol as TaskThread::WaitForTaskOrFds()
+  m_bConsumerSleeping.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (HasTasks() || GetGlobalQuit()) nTimeoutMs = 0;
+  int nReady = epoll_wait(m_pShared->nEpollFd, m_events.data(), int(m_events.size()), nTimeoutMs);
+  m_bConsumerSleeping.store(false, std::memory_order_relaxed);
+
+  if (nReady < 0) {
+    if (errno != EINTR) {
+      vlog_error(VCAT_GENERAL, "Reactor %s: epoll_wait failed: %s", m_strName.c_str(), strerror(errno));
+    }
+    return;
+  }
+  for (int i = 0; i < nReady; i++) {
+    const uint64_t nId = m_events[size_t(i)].data.u64;
+    if (nId == kWakeId) {
+      uint64_t nValue;
+      (void)!read(m_nWakeFd, &nValue, sizeof(nValue));
+    } else if (nId != kQuitId) {
+      Dispatch(nId, m_events[size_t(i)].events);
+    }
+  }
+  // A full batch: more fds may be ready, take more of them next time
+  if (size_t(nReady) == m_events.size() && m_events.size() < 4096) m_events.resize(m_events.size() * 2);
+}
@@ -0,0 +1,44 @@
+#include "striped_rate.h"
+
+#include <algorithm>
+#include <thread>
+
+StripedRate::StripedRate(double window_seconds, unsigned num_stripes)
+    : rate_(window_seconds) {
+  if (num_stripes == 0) {
+    num_stripes = std::max(1u, std::thread::hardware_concurrency());
+  }
+  unsigned n = 1;
+  while (n < num_stripes) n <<= 1;
+  stripes_.reset(new Stripe[n]);
+  mask_ = n - 1;
+}
+
+size_t StripedRate::total() const noexcept {
+  size_t sum = 0;
+  for (unsigned i = 0; i <= mask_; i++) {
+    sum += stripes_[i].count.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+void StripedRate::sample(double t) {
+  size_t sum = total();
+  std::lock_guard lock(reader_mutex_);
+  rate_.addPoint(sum, t);
+}
+
+double StripedRate::getRate(bool no_divide_by_zero) const {
+  std::lock_guard lock(reader_mutex_);
+  return rate_.getRate(no_divide_by_zero);
+}
+
+double StripedRate::getEwmaRate(Rate::EwmaWindow window) const {
+  std::lock_guard lock(reader_mutex_);
+  return rate_.getEwmaRate(window);
+}
+
+double StripedRate::getEwmaRate(Rate::EwmaWindow window, double t) const {
+  std::lock_guard lock(reader_mutex_);
+  return rate_.getEwmaRate(window, t);
+}
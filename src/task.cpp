@@ -6,3 +6,5 @@ AbstractTask::~AbstractTask() {}
 Task<void>::~Task() {}
 
 StringTask::~StringTask() {}
+
+FuncTask::~FuncTask() {}
@@ -0,0 +1,159 @@
+#include "task_graph.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "vlog.h"
+
+static int64_t SteadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+TaskGraph::NODEID TaskGraph::AddNode(const char* szName, std::function<void()> fn) {
+  auto pNode = std::make_unique<Node>();
+  pNode->pGraph = this;
+  pNode->strName = szName;
+  pNode->fn = std::move(fn);
+  m_nodes.push_back(std::move(pNode));
+  m_bValidated = false;
+  return m_nodes.size() - 1;
+}
+
+void TaskGraph::AddDependency(NODEID before, NODEID after) {
+  m_nodes[before]->successors.push_back(after);
+  m_nodes[after]->nDependencies++;
+  m_bValidated = false;
+}
+
+// Topological sort (Kahn). Leaves m_order shorter than the graph if there is a cycle.
+bool TaskGraph::Validate() {
+  if (m_bValidated) return m_bAcyclic;
+  m_bValidated = true;
+  m_roots.clear();
+  m_order.clear();
+  std::vector<int> pending(m_nodes.size());
+  for (size_t i = 0; i < m_nodes.size(); i++) {
+    pending[i] = m_nodes[i]->nDependencies;
+    if (pending[i] == 0) {
+      m_roots.push_back(i);
+      m_order.push_back(i);
+    }
+  }
+  for (size_t k = 0; k < m_order.size(); k++) {
+    for (NODEID next : m_nodes[m_order[k]]->successors) {
+      if (--pending[next] == 0) m_order.push_back(next);
+    }
+  }
+  m_bAcyclic = m_order.size() == m_nodes.size();
+  if (!m_bAcyclic) {
+    vlog_error(VCAT_GENERAL, "TaskGraph: the dependencies of %zu of its %zu nodes form a cycle",
+               m_nodes.size() - m_order.size(), m_nodes.size());
+  }
+  return m_bAcyclic;
+}
+
+bool TaskGraph::Run(ThreadPool& pool) {
+  if (!Validate()) return false;
+  if (m_nodes.empty()) return true;
+
+  m_pPool = &pool;
+  m_bFailed = false;
+  m_exception = nullptr;
+  m_bDone = false;
+  for (auto& pNode : m_nodes) {
+    pNode->nPending.store(pNode->nDependencies, std::memory_order_relaxed);
+    pNode->nStartNs = pNode->nEndNs = 0;
+  }
+  m_nRemaining.store(m_nodes.size(), std::memory_order_relaxed);
+  m_nRunStartNs = SteadyNowNs();
+  // Pushing publishes the state above to the workers
+  for (NODEID root : m_roots) pool.Push(m_nodes[root].get());
+
+  std::unique_lock lock(m_mutex);
+  m_doneCondition.wait(lock, [this]() { return m_bDone; });
+  if (m_exception) std::rethrow_exception(m_exception);
+  return true;
+}
+
+void TaskGraph::Node::Execute() {
+  TaskGraph& graph = *pGraph;
+  nStartNs = SteadyNowNs();
+  if (!graph.m_bFailed.load(std::memory_order_relaxed)) {
+    try {
+      fn();
+    } catch (...) {
+      std::lock_guard lock(graph.m_mutex);
+      if (!graph.m_exception) graph.m_exception = std::current_exception();
+      graph.m_bFailed = true;
+    }
+  }
+  nEndNs = SteadyNowNs();
+  for (NODEID next : successors) {
+    Node& nextNode = *graph.m_nodes[next];
+    if (nextNode.nPending.fetch_sub(1, std::memory_order_acq_rel) == 1) graph.m_pPool->Push(&nextNode);
+  }
+  graph.NodeDone();
+}
+
+void TaskGraph::NodeDone() {
+  if (m_nRemaining.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+  // Notify under the lock: Run() cannot return, and the graph cannot go away, before we are done
+  std::lock_guard lock(m_mutex);
+  m_bDone = true;
+  m_doneCondition.notify_all();
+}
+
+TaskGraphReport TaskGraph::GetReport() const {
+  TaskGraphReport report;
+  if (!m_bValidated || !m_bAcyclic || m_nRunStartNs == 0) return report;
+
+  report.nodes.resize(m_nodes.size());
+  int64_t nLastEndNs = m_nRunStartNs;
+  for (size_t i = 0; i < m_nodes.size(); i++) {
+    const Node& node = *m_nodes[i];
+    report.nodes[i].strName = node.strName;
+    report.nodes[i].nStartNs = node.nStartNs - m_nRunStartNs;
+    report.nodes[i].nDurationNs = node.nEndNs - node.nStartNs;
+    nLastEndNs = std::max(nLastEndNs, node.nEndNs);
+  }
+  report.nWallNs = nLastEndNs - m_nRunStartNs;
+
+  // Longest path by duration, in topological order
+  std::vector<int64_t> pathNs(m_nodes.size(), 0);
+  std::vector<size_t> previous(m_nodes.size(), SIZE_MAX);
+  for (NODEID id : m_order) {
+    pathNs[id] += report.nodes[id].nDurationNs;
+    for (NODEID next : m_nodes[id]->successors) {
+      if (pathNs[id] > pathNs[next] || previous[next] == SIZE_MAX) {
+        pathNs[next] = pathNs[id];
+        previous[next] = id;
+      }
+    }
+  }
+  NODEID last = size_t(std::max_element(pathNs.begin(), pathNs.end()) - pathNs.begin());
+  report.nCriticalPathNs = pathNs[last];
+  for (NODEID id = last; id != SIZE_MAX; id = previous[id]) {
+    report.criticalPath.push_back(id);
+    report.nodes[id].bCritical = true;
+  }
+  std::reverse(report.criticalPath.begin(), report.criticalPath.end());
+  return report;
+}
+
+std::string TaskGraphReport::ToString() const {
+  std::string strReport;
+  char szLine[256];
+  snprintf(szLine, sizeof(szLine), "wall %.3f ms, critical path %.3f ms:\n", double(nWallNs) * 1e-6,
+           double(nCriticalPathNs) * 1e-6);
+  strReport += szLine;
+  for (size_t id : criticalPath) {
+    const NodeTiming& node = nodes[id];
+    snprintf(szLine, sizeof(szLine), "  %-32s start %9.3f ms  run %9.3f ms  %5.1f%%\n", node.strName.c_str(),
+             double(node.nStartNs) * 1e-6, double(node.nDurationNs) * 1e-6,
+             nCriticalPathNs > 0 ? 100.0 * double(node.nDurationNs) / double(nCriticalPathNs) : 0.0);
+    strReport += szLine;
+  }
+  return strReport;
+}
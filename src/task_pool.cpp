@@ -0,0 +1,144 @@
+#include "task_pool.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+constexpr size_t kMinBlockShift = 6;  // 64-byte blocks, header included
+constexpr size_t kNumClasses = 7;     // 64 .. 4096
+
+struct Cache;
+
+// Precedes every block. Keeps the payload aligned for any type.
+struct alignas(alignof(std::max_align_t)) BlockHeader {
+  Cache* owner;  // nullptr for blocks that bypass the pool
+  BlockHeader* next;
+};
+
+// Marks the remote list of a cache whose thread has exited
+BlockHeader* const kClosed = reinterpret_cast<BlockHeader*>(uintptr_t(1));
+
+std::atomic<int64_t> nLiveBlocks_(0);
+
+// The free blocks of one size class for one thread
+struct Cache {
+  explicit Cache(size_t nSizeClass)
+      : sizeClass(nSizeClass)
+      , blockSize(size_t(1) << (nSizeClass + kMinBlockShift)) {}
+
+  const size_t sizeClass;
+  const size_t blockSize;
+  BlockHeader* local = nullptr;             // owner thread only
+  std::atomic<BlockHeader*> remote{nullptr};  // blocks returned by other threads
+  // Blocks created by this cache and not yet released, plus one for the owner thread while it runs.
+  std::atomic<int64_t> refs{1};
+};
+
+void ReleaseBlocks(Cache* pCache, int64_t nBlocks) {
+  if (pCache->refs.fetch_sub(nBlocks, std::memory_order_acq_rel) == nBlocks) {
+    delete pCache;
+  }
+}
+
+void DeleteBlock(BlockHeader* pBlock) {
+  std::free(pBlock);
+  nLiveBlocks_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// The trivially destructible pointers stay usable during thread exit; the guard object closes the
+// caches when the thread ends.
+thread_local Cache* pCaches_[kNumClasses] = {};
+thread_local bool bThreadExiting_ = false;
+
+struct CacheGuard {
+  ~CacheGuard() {
+    bThreadExiting_ = true;
+    for (auto& pCache : pCaches_) {
+      if (!pCache) continue;
+      int64_t nReleased = 1;
+      BlockHeader* pLists[2] = {pCache->local, pCache->remote.exchange(kClosed, std::memory_order_acquire)};
+      for (BlockHeader* pBlock : pLists) {
+        while (pBlock) {
+          BlockHeader* pNext = pBlock->next;
+          DeleteBlock(pBlock);
+          nReleased++;
+          pBlock = pNext;
+        }
+      }
+      pCache->local = nullptr;
+      ReleaseBlocks(pCache, nReleased);
+      pCache = nullptr;
+    }
+  }
+};
+thread_local CacheGuard cacheGuard_;
+
+size_t SizeClass(size_t nBytes) {
+  size_t cls = 0;
+  while ((size_t(1) << (cls + kMinBlockShift)) < nBytes) cls++;
+  return cls;
+}
+
+}  // namespace
+
+void* TaskPool::Allocate(size_t size) {
+  const size_t nBytes = size + sizeof(BlockHeader);
+  if (nBytes > kMaxBlockSize || bThreadExiting_) {
+    auto* pBlock = static_cast<BlockHeader*>(std::malloc(nBytes));
+    if (!pBlock) throw std::bad_alloc();
+    pBlock->owner = nullptr;
+    return pBlock + 1;
+  }
+
+  const size_t cls = SizeClass(nBytes);
+  Cache*& pCache = pCaches_[cls];
+  if (!pCache) {
+    (void)&cacheGuard_;  // odr-use, so the guard is constructed for this thread
+    pCache = new Cache(cls);
+  }
+  if (!pCache->local) {
+    pCache->local = pCache->remote.exchange(nullptr, std::memory_order_acquire);
+  }
+  BlockHeader* pBlock = pCache->local;
+  if (pBlock) {
+    pCache->local = pBlock->next;
+  } else {
+    pBlock = static_cast<BlockHeader*>(std::malloc(pCache->blockSize));
+    if (!pBlock) throw std::bad_alloc();
+    pBlock->owner = pCache;
+    pCache->refs.fetch_add(1, std::memory_order_relaxed);
+    nLiveBlocks_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return pBlock + 1;
+}
+
+void TaskPool::Free(void* p) noexcept {
+  if (!p) return;
+  BlockHeader* pBlock = static_cast<BlockHeader*>(p) - 1;
+  Cache* pCache = pBlock->owner;
+  if (!pCache) {
+    std::free(pBlock);
+    return;
+  }
+  if (pCaches_[pCache->sizeClass] == pCache) {
+    // Freed by the owner thread
+    pBlock->next = pCache->local;
+    pCache->local = pBlock;
+    return;
+  }
+  BlockHeader* pHead = pCache->remote.load(std::memory_order_relaxed);
+  do {
+    if (pHead == kClosed) {
+      // The owner thread has exited
+      DeleteBlock(pBlock);
+      ReleaseBlocks(pCache, 1);
+      return;
+    }
+    pBlock->next = pHead;
+  } while (!pCache->remote.compare_exchange_weak(pHead, pBlock, std::memory_order_release,
+                                                 std::memory_order_relaxed));
+}
+
+int64_t TaskPool::GetLiveBlockCount() { return nLiveBlocks_.load(std::memory_order_relaxed); }
@@ -2,30 +2,106 @@
 #include "taskthread.h"
 
 #include <pthread.h>  // POSIX threads
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "vlog.h"
 
 static std::atomic_bool bTaskThreadGlobalQuit_(false);
+static thread_local TaskThread* pCurrentTaskThread_ = nullptr;
+
+TaskThread* TaskThread::GetCurrent() { return pCurrentTaskThread_; }
+
+// Readable while the global quit is set, so every thread sleeping in WaitForTask*() wakes up.
+int TaskThread::GetGlobalQuitFd() {
+  static const int nFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  return nFd;
+}
 
 // Common Quit for all TaskThreads, causes all TaskThreads to exit their loop.
-void TaskThread::SetGlobalQuit(bool bQuit) { bTaskThreadGlobalQuit_ = bQuit; }
+void TaskThread::SetGlobalQuit(bool bQuit) {
+  bTaskThreadGlobalQuit_ = bQuit;
+  uint64_t nValue = 1;
+  if (bQuit) {
+    if (write(GetGlobalQuitFd(), &nValue, sizeof(nValue)) < 0) {
+      vlog_error(VCAT_GENERAL, "TaskThread::SetGlobalQuit() could not signal the quit eventfd: %d", errno);
+    }
+  } else {
+    // Drain the eventfd, it stays readable otherwise
+    while (read(GetGlobalQuitFd(), &nValue, sizeof(nValue)) > 0) {
+    }
+  }
+}
 bool TaskThread::GetGlobalQuit() { return bTaskThreadGlobalQuit_; }
 
+int TaskThread::CreateWakeFd() {
+  int nFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (nFd < 0) {
+    vlog_error(VCAT_GENERAL, "TaskThread could not create its wake-up eventfd (%d), falling back to polling",
+               errno);
+  }
+  return nFd;
+}
+
+static int64_t SteadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct TaskThread::StatsData {
+  struct TagKey {
+    const char* szName;
+    uint32_t nLine;
+    bool operator==(const TagKey& other) const { return szName == other.szName && nLine == other.nLine; }
+  };
+  struct TagKeyHash {
+    size_t operator()(const TagKey& key) const {
+      return std::hash<const void*>()(key.szName) ^ (size_t(key.nLine) * 0x9E3779B97F4A7C15ull);
+    }
+  };
+
+  LatencyHistogram queueWait;
+  LatencyHistogram runTime;
+  std::atomic<uint64_t> nTasks{0};
+  std::atomic<int64_t> nMaxQueueDepth{0};
+  const int64_t nStartNs = SteadyNowNs();
+
+  mutable std::mutex mutex;  // guards tags, against GetStats()
+  std::unordered_map<TagKey, TaskThreadStats::TagStats, TagKeyHash> tags;
+};
+
 TaskThread::TaskThread(const char* szName)
     : m_strName(szName) {}
 
 TaskThread::~TaskThread() {
   // TRACE( "TaskThread::~TaskThread()   %s \n", m_strName.empty()? "<unnamed task thread>" :
   // m_strName.c_str() );
+  if (m_nWakeFd >= 0) close(m_nWakeFd);
+  delete m_pStats.load(std::memory_order_acquire);
 }
 
 // To override virtual Run(), construction does nothing, and you need a separate Start() function.
 void TaskThread::Start(void* pExtra) {
   // TRACE( "TaskThread::Start()  %s \n", m_strName.empty()? "<unnamed thread>" : m_strName.c_str() );
   std::thread& t = *this;
-  t = std::thread(&TaskThread::ThreadProc, this, pExtra);
+  {
+    ScopedThreadStackSize stackSize(m_threadOptions.nStackSize);
+    t = std::thread(&TaskThread::ThreadProc, this, pExtra);
+  }
   pthread_setname_np(t.native_handle(), m_strName.c_str());
 }
 
-void TaskThread::ThreadProc(void* pExtra) { this->Run(pExtra); }
+void TaskThread::ThreadProc(void* pExtra) {
+  ApplyThreadOptions(m_threadOptions, m_strName.c_str());
+  pCurrentTaskThread_ = this;
+  this->Run(pExtra);
+}
 
 void TaskThread::Run(void* pExtra) {
   // std::thread::id  thread_id = std::this_thread::get_id();
@@ -41,47 +117,479 @@ void TaskThread::Run(void* pExtra) {
 // e.g. an Application Main Thread can Poll() to execute tasks.
 void TaskThread::Poll(void* pExtra) {
   (void)pExtra;
-  AbstractTask* pTask = this->Pop();
-  while (pTask && !GetGlobalQuit()) {
-    pTask->Execute();  // Get the result in this thread
-    pTask = this->Pop();
+  TaskThread* pPrevious = pCurrentTaskThread_;
+  pCurrentTaskThread_ = this;
+  // Run as many tasks as are pending now, as one batch. Tasks pushed meanwhile are sorted in as
+  // they arrive (so an urgent task does not wait for the whole batch) but do not extend the batch:
+  // a stream of new tasks cannot keep Poll() from returning.
+  TakePushedTasks();
+  const size_t nBatch = std::min(m_nQueued, m_nMaxBatch);
+  const bool bTimed = m_nBatchBudgetNs > 0;
+  const auto deadline = bTimed ? std::chrono::steady_clock::now() + std::chrono::nanoseconds(m_nBatchBudgetNs)
+                               : std::chrono::steady_clock::time_point();
+  for (size_t nExecuted = 0; nExecuted < nBatch && !GetGlobalQuit(); nExecuted++) {
+    AbstractTask* pTask = this->Pop();
+    if (!pTask) break;
+    const int64_t nPushedNs = std::exchange(pTask->nPushedNs, 0);
+    if (m_bStatsEnabled.load(std::memory_order_relaxed)) {
+      ExecuteWithStats(pTask, nPushedNs);
+    } else {
+      pTask->Execute();  // Get the result in this thread
+    }
+    if (bTimed && std::chrono::steady_clock::now() >= deadline) break;
   }
 
   this->IdlePoll();
+  pCurrentTaskThread_ = pPrevious;
+}
+
+void TaskThread::SetBatchLimits(size_t nMaxBatch, std::chrono::nanoseconds budget) {
+  m_nMaxBatch = nMaxBatch > 0 ? nMaxBatch : SIZE_MAX;
+  m_nBatchBudgetNs = budget.count();
 }
 
 void TaskThread::IdlePoll() {}
 
+void TaskThread::ExecuteWithStats(AbstractTask* pTask, int64_t nPushedNs) {
+  StatsData* pStats = m_pStats.load(std::memory_order_acquire);
+  if (!pStats) {
+    pTask->Execute();
+    return;
+  }
+  // Read the tag first: the task may delete itself, or be pushed again
+  const StatsData::TagKey key{pTask->szName, pTask->nLine};
+  const int64_t nStartNs = SteadyNowNs();
+  pTask->Execute();
+  const uint64_t nRunNs = uint64_t(SteadyNowNs() - nStartNs);
+  // Tasks pushed before statistics were enabled have no push time
+  const uint64_t nWaitNs = nPushedNs > 0 && nStartNs > nPushedNs ? uint64_t(nStartNs - nPushedNs) : 0;
+
+  if (nPushedNs > 0) pStats->queueWait.record(nWaitNs);
+  pStats->runTime.record(nRunNs);
+  pStats->nTasks.store(pStats->nTasks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::lock_guard lock(pStats->mutex);
+  TaskThreadStats::TagStats& tag = pStats->tags[key];
+  tag.nCount++;
+  tag.nWaitNs += nWaitNs;
+  tag.nRunNs += nRunNs;
+  tag.nMaxRunNs = std::max(tag.nMaxRunNs, nRunNs);
+}
+
+void TaskThread::EnableStats(bool bEnable) {
+  if (bEnable && !m_pStats.load(std::memory_order_acquire)) {
+    StatsData* pExpected = nullptr;
+    StatsData* pStats = new StatsData();
+    if (!m_pStats.compare_exchange_strong(pExpected, pStats, std::memory_order_acq_rel)) delete pStats;
+  }
+  m_bStatsEnabled.store(bEnable, std::memory_order_release);
+}
+
+TaskThreadStats TaskThread::GetStats() const {
+  TaskThreadStats result;
+  for (const auto& nDepth : m_nDepth) result.nQueueDepth += nDepth.load(std::memory_order_relaxed);
+  const StatsData* pStats = m_pStats.load(std::memory_order_acquire);
+  if (!pStats) return result;
+
+  result.queueWait = pStats->queueWait.snapshot();
+  result.runTime = pStats->runTime.snapshot();
+  result.nTasks = pStats->nTasks.load(std::memory_order_relaxed);
+  const int64_t nElapsedNs = SteadyNowNs() - pStats->nStartNs;
+  result.dTasksPerSecond = nElapsedNs > 0 ? double(result.nTasks) * 1e9 / double(nElapsedNs) : 0.0;
+  result.nMaxQueueDepth = pStats->nMaxQueueDepth.load(std::memory_order_relaxed);
+
+  // Tags are keyed by pointer; equal strings at different addresses are merged here
+  std::map<std::string, TaskThreadStats::TagStats> tags;
+  {
+    std::lock_guard lock(pStats->mutex);
+    for (const auto& [key, counters] : pStats->tags) {
+      std::string strTag = !key.szName  ? "<untagged>"
+                           : key.nLine ? std::string(key.szName) + ":" + std::to_string(key.nLine)
+                                       : std::string(key.szName);
+      TaskThreadStats::TagStats& tag = tags[strTag];
+      tag.nCount += counters.nCount;
+      tag.nWaitNs += counters.nWaitNs;
+      tag.nRunNs += counters.nRunNs;
+      tag.nMaxRunNs = std::max(tag.nMaxRunNs, counters.nMaxRunNs);
+    }
+  }
+  for (auto& [strTag, tag] : tags) {
+    tag.strTag = strTag;
+    result.tags.push_back(std::move(tag));
+  }
+  std::sort(result.tags.begin(), result.tags.end(),
+            [](const TaskThreadStats::TagStats& a, const TaskThreadStats::TagStats& b) {
+              return a.nRunNs > b.nRunNs;
+            });
+  return result;
+}
+
+// A task leaving the queue, run or not, is pushed again with plain Push() as a normal task
+static void ResetPushOptions(AbstractTask* pTask) {
+  pTask->nPriority = TASK_PRIORITY_NORMAL;
+  pTask->nDeadlineNs = 0;
+}
+
 // Push tasks for this thread to execute.
 void TaskThread::Push(AbstractTask* pTask) {
-  std::lock_guard lock(m_mutex);  // lock the scope
-  m_queue.push_back(pTask);
-  m_condition.notify_one();
+  if (Admit(pTask)) Enqueue(pTask);
+}
+
+bool TaskThread::TryPush(AbstractTask* pTask) {
+  const size_t nCapacity = m_nCapacity.load(std::memory_order_relaxed);
+  if (nCapacity == 0) {
+    if (m_bStatsEnabled.load(std::memory_order_relaxed)) TakeSlot(pTask);
+  } else if (!TryReserve(pTask, nCapacity)) {
+    ResetPushOptions(pTask);
+    return false;
+  }
+  Enqueue(pTask);
+  return true;
+}
+
+void TaskThread::SetCapacity(size_t nCapacity, TaskOverflowPolicy nPolicy) {
+  m_nOverflowPolicy.store(nPolicy, std::memory_order_relaxed);
+  m_nCapacity.store(nCapacity, std::memory_order_relaxed);
+  // Blocked producers may now fit, or have to reject
+  std::lock_guard lock(m_capacityMutex);
+  m_capacityCondition.notify_all();
+}
+
+bool TaskThread::Admit(AbstractTask* pTask) {
+  const size_t nCapacity = m_nCapacity.load(std::memory_order_relaxed);
+  const TaskOverflowPolicy nPolicy = m_nOverflowPolicy.load(std::memory_order_relaxed);
+  if (nCapacity == 0) {
+    // Unbounded producers share no counter, unless statistics are enabled
+    if (m_bStatsEnabled.load(std::memory_order_relaxed)) TakeSlot(pTask);
+    return true;
+  }
+  if (TryReserve(pTask, nCapacity)) return true;
+  // Tasks that must run (coroutine hops) go over capacity rather than be discarded
+  if (!pTask->bDiscardable && nPolicy != TASK_OVERFLOW_BLOCK) {
+    TakeSlot(pTask);
+    return true;
+  }
+  if (nPolicy == TASK_OVERFLOW_DROP_OLDEST) {
+    // The consumer drops the oldest tasks when it takes the new ones. While it is busy in a long
+    // task, the queue may grow to twice the capacity: past that, the new task is the one dropped.
+    if (TryReserve(pTask, nCapacity > SIZE_MAX / 2 ? SIZE_MAX : 2 * nCapacity)) return true;
+    m_nDropped.fetch_add(1, std::memory_order_relaxed);
+    ResetPushOptions(pTask);
+    pTask->Discard();
+    return false;
+  }
+  if (nPolicy == TASK_OVERFLOW_REJECT) {
+    m_nRejected.fetch_add(1, std::memory_order_relaxed);
+    ResetPushOptions(pTask);
+    pTask->Discard();
+    return false;
+  }
+  // Block, unless we are the consumer: it would never make room
+  if (pCurrentTaskThread_ != this) {
+    std::unique_lock lock(m_capacityMutex);
+    // Pairs with ReleaseSlot(): either the consumer sees us blocked, or we see the room it made
+    m_nBlockedProducers.fetch_add(1, std::memory_order_seq_cst);
+    bool bReserved = false;
+    while (!(bReserved = TryReserve(pTask, m_nCapacity.load(std::memory_order_relaxed))) &&
+           !GetGlobalQuit() && m_nCapacity.load(std::memory_order_relaxed) > 0 &&
+           m_nOverflowPolicy.load(std::memory_order_relaxed) == TASK_OVERFLOW_BLOCK) {
+      // The timeout bounds how long a SetGlobalQuit() goes unnoticed
+      m_capacityCondition.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    m_nBlockedProducers.fetch_sub(1, std::memory_order_relaxed);
+    if (bReserved) return true;
+  }
+  // Quitting, reconfigured, or pushing to ourselves: over capacity
+  TakeSlot(pTask);
+  return true;
+}
+
+bool TaskThread::TryReserve(AbstractTask* pTask, size_t nCapacity) {
+  if (nCapacity == 0) return false;
+  size_t nSize = m_nSize.load(std::memory_order_seq_cst);
+  do {
+    if (nSize >= nCapacity) return false;
+  } while (!m_nSize.compare_exchange_weak(nSize, nSize + 1, std::memory_order_seq_cst));
+  pTask->bCounted = true;
+  NoteSize(nSize + 1);
+  return true;
+}
+
+void TaskThread::TakeSlot(AbstractTask* pTask) {
+  pTask->bCounted = true;
+  NoteSize(m_nSize.fetch_add(1, std::memory_order_relaxed) + 1);
+}
+
+void TaskThread::NoteSize(size_t nSize) {
+  size_t nHighest = m_nHighWaterMark.load(std::memory_order_relaxed);
+  while (nSize > nHighest &&
+         !m_nHighWaterMark.compare_exchange_weak(nHighest, nSize, std::memory_order_relaxed)) {
+  }
+}
+
+// Tasks pushed before the queue was bounded, or statistics enabled, hold no slot
+void TaskThread::ReleaseSlot(AbstractTask* pTask) {
+  if (!pTask->bCounted) return;
+  pTask->bCounted = false;
+  m_nSize.fetch_sub(1, std::memory_order_seq_cst);
+  if (m_nBlockedProducers.load(std::memory_order_seq_cst) > 0) {
+    std::lock_guard lock(m_capacityMutex);
+    m_capacityCondition.notify_all();
+  }
 }
 
+// Discard the oldest task at the head of a priority list (the lowest class on ties), unless it must
+// run. Consumer only.
+bool TaskThread::DropOldest() {
+  int nClass = -1;
+  for (int i = TASK_PRIORITY_COUNT - 1; i >= 0; i--) {
+    AbstractTask* pHead = m_lists[i].pHead;
+    if (pHead && pHead->bDiscardable &&
+        (nClass < 0 || pHead->nQueuedNs < m_lists[nClass].pHead->nQueuedNs)) {
+      nClass = i;
+    }
+  }
+  if (nClass < 0) return false;
+  TaskList& list = m_lists[nClass];
+  AbstractTask* pTask = list.pHead;
+  list.pHead = pTask->pNextTask;
+  if (!list.pHead) list.pTail = nullptr;
+  m_nQueued--;
+  m_nDepth[nClass].fetch_sub(1, std::memory_order_relaxed);
+  pTask->pNextTask = nullptr;
+  pTask->nPushedNs = 0;
+  ResetPushOptions(pTask);
+  m_nDropped.fetch_add(1, std::memory_order_relaxed);
+  ReleaseSlot(pTask);
+  pTask->Discard();
+  return true;
+}
+
+void TaskThread::Enqueue(AbstractTask* pTask) {
+  // Stamped here, not when the consumer takes the task: time spent in the pushed stack counts
+  pTask->nQueuedNs = SteadyNowNs();
+  if (m_bStatsEnabled.load(std::memory_order_relaxed)) pTask->nPushedNs = pTask->nQueuedNs;
+  m_nDepth[pTask->nDeadlineNs ? TASK_PRIORITY_COUNT : pTask->nPriority].fetch_add(1, std::memory_order_relaxed);
+  AbstractTask* pHead = m_pPushed.load(std::memory_order_relaxed);
+  do {
+    pTask->pNextTask = pHead;
+  } while (!m_pPushed.compare_exchange_weak(pHead, pTask, std::memory_order_release, std::memory_order_relaxed));
+
+  // Pairs with the fence in WaitForTaskOrFds(): either the consumer sees the task before sleeping, or
+  // we see its flag. Only the first producer to see the flag pays for the wake-up.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_bConsumerSleeping.load(std::memory_order_relaxed) &&
+      m_bConsumerSleeping.exchange(false, std::memory_order_relaxed) && m_nWakeFd >= 0) {
+    uint64_t nValue = 1;
+    if (write(m_nWakeFd, &nValue, sizeof(nValue)) < 0 && errno != EAGAIN) {
+      vlog_error(VCAT_GENERAL, "TaskThread::Push() could not wake %s: %d", m_strName.c_str(), errno);
+    }
+  }
+}
+
+void TaskThread::Push(AbstractTask* pTask, TaskPriority nPriority) {
+  pTask->nPriority = nPriority;
+  Push(pTask);
+}
+
+void TaskThread::PushWithDeadline(AbstractTask* pTask, std::chrono::steady_clock::time_point deadline,
+                                  TaskPriority nPriority) {
+  // 0 means no deadline; a deadline at the clock's epoch is as urgent as 1ns
+  pTask->nDeadlineNs = std::max<int64_t>(
+      1, std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count());
+  pTask->nPriority = nPriority;
+  Push(pTask);
+}
+
+int64_t TaskThread::GetQueueDepth(TaskPriority nPriority) const {
+  return m_nDepth[nPriority].load(std::memory_order_relaxed);
+}
+
+int64_t TaskThread::GetDeadlineQueueDepth() const {
+  return m_nDepth[TASK_PRIORITY_COUNT].load(std::memory_order_relaxed);
+}
+
+static bool LaterDeadline(const AbstractTask* a, const AbstractTask* b) { return a->nDeadlineNs > b->nDeadlineNs; }
+
 // This thread Pops tasks and executes them.
 AbstractTask* TaskThread::Pop() {
-  AbstractTask* pTask = NULL;
-  std::lock_guard lock(m_mutex);  // lock the scope
-  if (m_queue.size() > 0) {
-    pTask = m_queue.front();
-    m_queue.pop_front();
+  TakePushedTasks();
+  if (m_nQueued == 0) return nullptr;
+  m_nQueued--;
+
+  // Queues in the order they run: per class, the deadline heap, then the FIFO list
+  auto getFront = [this](int nQueue) -> AbstractTask* {
+    if (nQueue & 1) return m_lists[nQueue / 2].pHead;
+    const auto& heap = m_deadlineHeaps[nQueue / 2];
+    return heap.empty() ? nullptr : heap.front();
+  };
+  // First non-empty queue, unless the first task of some queue has waited past the aging limit. Only
+  // fronts are aged: a list front is its oldest task, a heap front its earliest deadline.
+  constexpr int kQueues = 2 * TASK_PRIORITY_COUNT;
+  int nQueue = -1;
+  int nNonEmpty = 0;
+  for (int i = 0; i < kQueues; i++) {
+    if (getFront(i)) {
+      if (nQueue < 0) nQueue = i;
+      nNonEmpty++;
+    }
   }
+  if (m_nAgingNs > 0 && nNonEmpty > 1) {
+    const int64_t nAgedBefore = SteadyNowNs() - m_nAgingNs;
+    int64_t nOldest = INT64_MAX;
+    for (int i = 0; i < kQueues; i++) {
+      AbstractTask* pFront = getFront(i);
+      if (pFront && pFront->nQueuedNs < nAgedBefore && pFront->nQueuedNs < nOldest) {
+        nOldest = pFront->nQueuedNs;
+        nQueue = i;
+      }
+    }
+  }
+
+  AbstractTask* pTask = nullptr;
+  const int nClass = nQueue / 2;
+  if (nQueue & 1) {
+    TaskList& list = m_lists[nClass];
+    pTask = list.pHead;
+    list.pHead = pTask->pNextTask;
+    if (!list.pHead) list.pTail = nullptr;
+    m_nDepth[nClass].fetch_sub(1, std::memory_order_relaxed);
+  } else {
+    auto& heap = m_deadlineHeaps[nClass];
+    std::pop_heap(heap.begin(), heap.end(), LaterDeadline);
+    pTask = heap.back();
+    heap.pop_back();
+    m_nDepth[TASK_PRIORITY_COUNT].fetch_sub(1, std::memory_order_relaxed);
+    if (SteadyNowNs() > pTask->nDeadlineNs) m_nDeadlineMisses.fetch_add(1, std::memory_order_relaxed);
+  }
+  pTask->pNextTask = nullptr;
+  ResetPushOptions(pTask);
+  ReleaseSlot(pTask);
   return pTask;
 }
 
-void TaskThread::WaitForTask() {
-  std::unique_lock<std::mutex> lock(m_mutex);  // lock the scope
-  if (m_queue.size() == 0) {
-    m_condition.wait(lock);
+// Sort the tasks pushed since the last call into the priority lists and the deadline heaps.
+void TaskThread::TakePushedTasks() {
+  if (!m_pPushed.load(std::memory_order_relaxed)) return;
+  AbstractTask* pStack = m_pPushed.exchange(nullptr, std::memory_order_acquire);
+  // Reverse the pushed stack into push order
+  AbstractTask* pBatch = nullptr;
+  while (pStack) {
+    AbstractTask* pNext = pStack->pNextTask;
+    pStack->pNextTask = pBatch;
+    pBatch = pStack;
+    pStack = pNext;
+  }
+  while (pBatch) {
+    AbstractTask* pTask = pBatch;
+    pBatch = pTask->pNextTask;
+    pTask->pNextTask = nullptr;
+    m_nQueued++;
+    if (pTask->nDeadlineNs) {
+      auto& heap = m_deadlineHeaps[pTask->nPriority];
+      heap.push_back(pTask);
+      std::push_heap(heap.begin(), heap.end(), LaterDeadline);
+      continue;
+    }
+    TaskList& list = m_lists[pTask->nPriority];
+    if (list.pTail) {
+      list.pTail->pNextTask = pTask;
+    } else {
+      list.pHead = pTask;
+    }
+    list.pTail = pTask;
+  }
+  if (m_nOverflowPolicy.load(std::memory_order_relaxed) == TASK_OVERFLOW_DROP_OLDEST) {
+    const size_t nCapacity = m_nCapacity.load(std::memory_order_relaxed);
+    while (nCapacity > 0 && m_nQueued > nCapacity && DropOldest()) {
+    }
+  }
+  if (m_bStatsEnabled.load(std::memory_order_relaxed)) {
+    StatsData* pStats = m_pStats.load(std::memory_order_acquire);
+    if (pStats && int64_t(m_nQueued) > pStats->nMaxQueueDepth.load(std::memory_order_relaxed)) {
+      pStats->nMaxQueueDepth.store(int64_t(m_nQueued), std::memory_order_relaxed);
+    }
   }
 }
 
-void TaskThread::WaitForTaskTimeoutMs(int milliseconds) {
-  std::unique_lock<std::mutex> lock(m_mutex);  // lock the scope
-  if (m_queue.size() == 0) {
-    m_condition.wait_for(lock, std::chrono::milliseconds(milliseconds));
+bool TaskThread::HasTasks() const {
+  return m_nQueued > 0 || m_pPushed.load(std::memory_order_relaxed) != nullptr;
+}
+
+void TaskThread::WaitForTask() { WaitForTaskOrFds(nullptr, 0, -1); }
+
+void TaskThread::WaitForTaskTimeoutMs(int milliseconds) { WaitForTaskOrFds(nullptr, 0, milliseconds); }
+
+int TaskThread::WaitForTaskOrFds(pollfd* pFds, size_t nFds, int milliseconds) {
+  // Without an eventfd, pushes cannot wake us: poll at the old 100ms period
+  if (m_nWakeFd < 0 && (milliseconds < 0 || milliseconds > 100)) milliseconds = 100;
+
+  m_pollFds.resize(nFds + 2);
+  m_pollFds[0] = {m_nWakeFd, POLLIN, 0};
+  m_pollFds[1] = {GetGlobalQuitFd(), POLLIN, 0};
+  for (size_t i = 0; i < nFds; i++) {
+    m_pollFds[i + 2] = {pFds[i].fd, pFds[i].events, 0};
+  }
+
+  m_bConsumerSleeping.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (HasTasks() || GetGlobalQuit()) milliseconds = 0;  // still report the fds that are ready
+  int nReady = poll(m_pollFds.data(), m_pollFds.size(), milliseconds);
+  m_bConsumerSleeping.store(false, std::memory_order_relaxed);
+
+  if (nReady < 0) {
+    if (errno != EINTR) {
+      vlog_error(VCAT_GENERAL, "TaskThread::WaitForTaskOrFds() poll failed on %s: %d", m_strName.c_str(), errno);
+    }
+    nReady = 0;
+  }
+  if (m_pollFds[0].revents & POLLIN) {
+    uint64_t nValue;
+    (void)!read(m_nWakeFd, &nValue, sizeof(nValue));
+  }
+  int nUserReady = 0;
+  for (size_t i = 0; i < nFds; i++) {
+    pFds[i].revents = m_pollFds[i + 2].revents;
+    if (pFds[i].revents) nUserReady++;
+  }
+  return nUserReady;
+}
+
+// Watch fds from the worker thread itself (from a task), or before Start().
+void WorkerThread::WatchFd(int fd, short events, FDHANDLER handler) {
+  UnwatchFd(fd);
+  m_watchedFds.push_back({fd, events, 0});
+  m_fdHandlers.push_back(std::move(handler));
+}
+
+void WorkerThread::UnwatchFd(int fd) {
+  for (size_t i = 0; i < m_watchedFds.size(); i++) {
+    if (m_watchedFds[i].fd == fd) {
+      m_watchedFds.erase(m_watchedFds.begin() + long(i));
+      m_fdHandlers.erase(m_fdHandlers.begin() + long(i));
+      return;
+    }
   }
 }
 
-void WorkerThread::IdlePoll() { WaitForTaskTimeoutMs(100); }
+// Sleep until a task is pushed, the global quit is set, or a watched fd is ready.
+void WorkerThread::IdlePoll() {
+  if (m_watchedFds.empty()) {
+    WaitForTask();
+    return;
+  }
+  if (WaitForTaskOrFds(m_watchedFds.data(), m_watchedFds.size(), -1) == 0) return;
+  // Handlers may watch or unwatch fds: collect the ready ones first
+  m_readyFds.clear();
+  for (const auto& p : m_watchedFds) {
+    if (p.revents) m_readyFds.push_back(p);
+  }
+  for (const auto& ready : m_readyFds) {
+    for (size_t i = 0; i < m_watchedFds.size(); i++) {
+      if (m_watchedFds[i].fd == ready.fd) {
+        FDHANDLER handler = m_fdHandlers[i];  // the handler may unwatch its own fd
+        handler(ready.fd, ready.revents);
+        break;
+      }
+    }
+  }
+}
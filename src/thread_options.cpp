@@ -0,0 +1,93 @@
+#include "thread_options.h"
+
+#include <limits.h>
+#include <pthread.h>  // POSIX threads
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "vlog.h"
+
+bool ApplyThreadOptions(const ThreadOptions& options, const char* szThreadName, size_t nCpuIndex) {
+  bool bApplied = true;
+  const pthread_t self = pthread_self();
+
+  if (!options.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (options.bOneCpuPerThread) {
+      int nCpu = options.cpus[nCpuIndex % options.cpus.size()];
+      if (nCpu >= 0 && nCpu < CPU_SETSIZE) CPU_SET(nCpu, &set);
+    } else {
+      for (int nCpu : options.cpus) {
+        if (nCpu >= 0 && nCpu < CPU_SETSIZE) CPU_SET(nCpu, &set);
+      }
+    }
+    int nError = CPU_COUNT(&set) > 0 ? pthread_setaffinity_np(self, sizeof(set), &set) : EINVAL;
+    if (nError) {
+      vlog_error(VCAT_GENERAL, "Thread %s could not set its CPU affinity: %s", szThreadName, strerror(nError));
+      bApplied = false;
+    }
+  }
+
+  if (options.nSchedPolicy == SCHED_FIFO || options.nSchedPolicy == SCHED_RR) {
+    sched_param param = {};
+    param.sched_priority = std::clamp(options.nSchedPriority, sched_get_priority_min(options.nSchedPolicy),
+                                      sched_get_priority_max(options.nSchedPolicy));
+    int nError = pthread_setschedparam(self, options.nSchedPolicy, &param);
+    if (nError) {
+      // Typically EPERM, when not running with CAP_SYS_NICE: keep the normal scheduling
+      vlog_warning(VCAT_GENERAL, "Thread %s could not switch to %s priority %d (%s), keeping SCHED_OTHER",
+                   szThreadName, options.nSchedPolicy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+                   param.sched_priority, strerror(nError));
+      bApplied = false;
+    }
+  }
+
+  if (options.nNice != 0) {
+    // On Linux the nice value is per thread, addressed by its tid
+    if (setpriority(PRIO_PROCESS, id_t(gettid()), options.nNice) < 0) {
+      vlog_warning(VCAT_GENERAL, "Thread %s could not set its nice value to %d: %s", szThreadName, options.nNice,
+                   strerror(errno));
+      bApplied = false;
+    }
+  }
+  return bApplied;
+}
+
+static std::mutex& StackSizeMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+ScopedThreadStackSize::ScopedThreadStackSize(size_t nStackSize) {
+  if (nStackSize == 0) return;
+  m_lock = std::unique_lock(StackSizeMutex());
+  pthread_attr_t attr;
+  if (pthread_getattr_default_np(&attr) != 0) return;
+  pthread_attr_getstacksize(&attr, &m_nPreviousSize);
+  // Round up to whole pages, and at least the minimum
+  const size_t nPage = size_t(sysconf(_SC_PAGESIZE));
+  nStackSize = std::max<size_t>(nStackSize, PTHREAD_STACK_MIN);
+  nStackSize = (nStackSize + nPage - 1) / nPage * nPage;
+  int nError = pthread_attr_setstacksize(&attr, nStackSize);
+  if (!nError) nError = pthread_setattr_default_np(&attr);
+  if (nError) {
+    vlog_error(VCAT_GENERAL, "Could not set the thread stack size to %zu: %s", nStackSize, strerror(nError));
+  } else {
+    m_bChanged = true;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+ScopedThreadStackSize::~ScopedThreadStackSize() {
+  if (!m_bChanged) return;
+  pthread_attr_t attr;
+  if (pthread_getattr_default_np(&attr) != 0) return;
+  pthread_attr_setstacksize(&attr, m_nPreviousSize);
+  pthread_setattr_default_np(&attr);
+  pthread_attr_destroy(&attr);
+}
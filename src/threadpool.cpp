@@ -0,0 +1,175 @@
+#include "threadpool.h"
+
+#include <pthread.h>  // POSIX threads
+
+#include <algorithm>
+#include <cassert>
+
+#include "taskthread.h"
+
+static thread_local ThreadPool* pCurrentPool_ = nullptr;
+static thread_local size_t nCurrentWorker_ = 0;
+
+ThreadPool::ThreadPool(const char* szName, size_t nThreads)
+    : m_strName(szName) {
+  if (nThreads == 0) {
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < nThreads; i++) {
+    m_workers.push_back(std::make_unique<Worker>());
+    m_workers.back()->rng = 0x9E3779B97F4A7C15ull * (i + 1);
+  }
+}
+
+ThreadPool::~ThreadPool() { Stop(); }
+
+ThreadPool& ThreadPool::GetShared() {
+  static ThreadPool pool("toolbox");
+  static std::once_flag started;
+  std::call_once(started, []() { pool.Start(); });
+  return pool;
+}
+
+void ThreadPool::Start() {
+  if (m_bStarted) return;
+  m_bStarted = true;
+  m_bStop = false;
+  ScopedThreadStackSize stackSize(m_threadOptions.nStackSize);
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    std::thread& t = m_workers[i]->thread;
+    t = std::thread(&ThreadPool::WorkerProc, this, i);
+    // Thread names are limited to 15 characters
+    std::string strName = m_strName + ":" + std::to_string(i);
+    if (strName.size() > 15) strName = strName.substr(strName.size() - 15);
+    pthread_setname_np(t.native_handle(), strName.c_str());
+  }
+}
+
+void ThreadPool::Stop() {
+  if (!m_bStarted) return;
+  m_bStop = true;
+  {
+    std::lock_guard lock(m_sleepMutex);
+    m_sleepCondition.notify_all();
+  }
+  for (auto& w : m_workers) {
+    if (w->thread.joinable()) w->thread.join();
+  }
+  m_bStarted = false;
+}
+
+int ThreadPool::GetWorkerIndex() const { return pCurrentPool_ == this ? int(nCurrentWorker_) : -1; }
+
+// Push tasks for the pool to execute.
+void ThreadPool::Push(AbstractTask* pTask) {
+  m_nPending.fetch_add(1, std::memory_order_relaxed);
+  if (pCurrentPool_ == this) {
+    m_workers[nCurrentWorker_]->deque.push(pTask);
+  } else {
+    std::lock_guard lock(m_mutex);  // lock the scope
+    m_queue.push_back(pTask);
+    m_nQueued.fetch_add(1, std::memory_order_relaxed);
+  }
+  WakeWorker();
+}
+
+void ThreadPool::WakeWorker() {
+  // Pairs with the fence in WorkerProc: either the worker going to sleep sees the new task, or we
+  // see it is sleeping and wake it up.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_nSleeping.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard lock(m_sleepMutex);
+    m_sleepCondition.notify_one();
+  }
+}
+
+void ThreadPool::WaitIdle() {
+  assert(GetWorkerIndex() < 0);
+  std::unique_lock lock(m_idleMutex);
+  while (m_nPending.load(std::memory_order_acquire) > 0 && !TaskThread::GetGlobalQuit()) {
+    // The timeout bounds how long a SetGlobalQuit() goes unnoticed
+    m_idleCondition.wait_for(lock, std::chrono::milliseconds(100));
+  }
+}
+
+void ThreadPool::Execute(AbstractTask* pTask) {
+  pTask->Execute();
+  if (m_nPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    {
+      std::lock_guard lock(m_idleMutex);
+    }
+    m_idleCondition.notify_all();
+    if (m_bStop) {
+      std::lock_guard lock(m_sleepMutex);
+      m_sleepCondition.notify_all();
+    }
+  }
+}
+
+bool ThreadPool::HasVisibleWork() const {
+  if (m_nQueued.load(std::memory_order_relaxed) > 0) return true;
+  for (const auto& w : m_workers) {
+    if (!w->deque.empty()) return true;
+  }
+  return false;
+}
+
+AbstractTask* ThreadPool::FindTask(size_t index) {
+  Worker& self = *m_workers[index];
+  AbstractTask* pTask = nullptr;
+  if (self.deque.pop(pTask)) return pTask;
+
+  if (m_nQueued.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard lock(m_mutex);
+    if (!m_queue.empty()) {
+      pTask = m_queue.front();
+      m_queue.pop_front();
+      // Take a fair share of the rest, so a large injected batch does not go through the lock one
+      // task at a time; other workers can still steal it from us.
+      size_t nShare = m_queue.size() / m_workers.size();
+      for (size_t i = 0; i < nShare; i++) {
+        self.deque.push(m_queue.front());
+        m_queue.pop_front();
+      }
+      m_nQueued.fetch_sub(nShare + 1, std::memory_order_relaxed);
+      return pTask;
+    }
+  }
+
+  // Steal, starting at a random victim (xorshift64)
+  const size_t n = m_workers.size();
+  self.rng ^= self.rng << 13;
+  self.rng ^= self.rng >> 7;
+  self.rng ^= self.rng << 17;
+  const size_t start = size_t(self.rng % n);
+  for (size_t k = 0; k < n; k++) {
+    size_t victim = (start + k) % n;
+    if (victim == index) continue;
+    if (m_workers[victim]->deque.steal(pTask)) return pTask;
+  }
+  return nullptr;
+}
+
+void ThreadPool::WorkerProc(size_t index) {
+  ApplyThreadOptions(m_threadOptions, m_strName.c_str(), index);
+  pCurrentPool_ = this;
+  nCurrentWorker_ = index;
+  while (!TaskThread::GetGlobalQuit()) {
+    AbstractTask* pTask = FindTask(index);
+    if (pTask) {
+      Execute(pTask);
+      continue;
+    }
+    if (m_bStop && m_nPending.load(std::memory_order_acquire) == 0) break;
+
+    std::unique_lock lock(m_sleepMutex);
+    m_nSleeping.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!HasVisibleWork() && !(m_bStop && m_nPending.load(std::memory_order_acquire) == 0)) {
+      // The timeout bounds how long a SetGlobalQuit() goes unnoticed
+      m_sleepCondition.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    m_nSleeping.fetch_sub(1, std::memory_order_relaxed);
+  }
+  pCurrentPool_ = nullptr;
+}
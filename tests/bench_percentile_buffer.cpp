@@ -0,0 +1,253 @@
+// Benchmark of PercentileBuffer against an exact baseline and the bounded-memory estimators.
+//
+// For every window size and input stream, it reports the cost of add() and of a percentile query,
+// the heap bytes held per element, and the error against a std::nth_element ground truth:
+//  - windowed estimators (PercentileBuffer, ExactWindow) are compared to the last 'window' samples,
+//  - whole-stream estimators (DDSketch, KLLSketch, P2Percentile, LatencyHistogram) to all samples.
+//
+// Output is one line per measurement, as JSON (default) or CSV, so results can be diffed or gated:
+//   bench_percentile_buffer --windows 1000,100000 --format csv > bench_output.csv
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "toolbox/cxxargs.h"
+#include "toolbox/latency_histogram.h"
+#include "toolbox/p2_percentile.h"
+#include "toolbox/percentile_buffer.h"
+#include "toolbox/quantile_sketch.h"
+
+// Track live heap bytes, to measure the memory held by each estimator
+static size_t live_bytes = 0;
+
+void* operator new(size_t size) {
+  void* p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  live_bytes += malloc_usable_size(p);
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  if (p) live_bytes -= malloc_usable_size(p);
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+using Clock = std::chrono::steady_clock;
+
+// Exact baseline: keep the window in a ring, select the percentile with nth_element on every query.
+class ExactWindow {
+public:
+  ExactWindow(size_t max_size, double percentile)
+      : ring_(max_size)
+      , percentile_(percentile) {}
+
+  void add(double v) {
+    ring_[next_++ % ring_.size()] = v;
+    size_ = std::min(size_ + 1, ring_.size());
+  }
+
+  double getPercentile() const {
+    if (size_ == 0) return 0.0;
+    scratch_.assign(ring_.begin(), ring_.begin() + long(size_));
+    size_t k = size_t(percentile_ * double(size_ - 1));
+    std::nth_element(scratch_.begin(), scratch_.begin() + long(k), scratch_.end());
+    return scratch_[k];
+  }
+
+private:
+  std::vector<double> ring_;
+  mutable std::vector<double> scratch_;
+  size_t next_ = 0;
+  size_t size_ = 0;
+  double percentile_;
+};
+
+// LatencyHistogram records integers; values are scaled to keep 3 decimals.
+class HistogramAdapter {
+public:
+  explicit HistogramAdapter(double percentile)
+      : percentile_(percentile) {}
+  void add(double v) { hist_.record(v > 0 ? uint64_t(v * 1000.0) : 0); }
+  double getPercentile() const { return double(hist_.snapshot().getPercentile(percentile_)) / 1000.0; }
+
+private:
+  LatencyHistogram hist_;
+  double percentile_;
+};
+
+static std::vector<double> make_stream(const std::string& kind, size_t n, std::mt19937_64& gen) {
+  std::vector<double> out(n);
+  if (kind == "uniform") {
+    std::uniform_real_distribution<double> dist(0.0, 1000.0);
+    for (auto& v : out) v = dist(gen);
+  } else if (kind == "zipf") {
+    // Zipf(s=1.1) over 100000 ranks, by inverse CDF
+    const size_t ranks = 100000;
+    std::vector<double> cdf(ranks);
+    double total = 0;
+    for (size_t r = 0; r < ranks; r++) {
+      total += 1.0 / std::pow(double(r + 1), 1.1);
+      cdf[r] = total;
+    }
+    std::uniform_real_distribution<double> dist(0.0, total);
+    for (auto& v : out) {
+      v = double(std::lower_bound(cdf.begin(), cdf.end(), dist(gen)) - cdf.begin() + 1);
+    }
+  } else if (kind == "sorted") {
+    for (size_t i = 0; i < n; i++) out[i] = double(i);
+  } else {
+    // Adversarial: alternate extremes with a slow drift, so every add crosses the percentile split
+    for (size_t i = 0; i < n; i++) {
+      out[i] = (i % 2) ? 1e6 + double(i) : double(n - i);
+    }
+  }
+  return out;
+}
+
+static double exact_percentile(std::vector<double> values, double q) {
+  size_t k = size_t(q * double(values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + long(k), values.end());
+  return values[k];
+}
+
+struct Result {
+  std::string estimator;
+  std::string stream;
+  size_t window;
+  size_t samples;
+  double ns_per_add;
+  double ns_per_query;
+  double bytes_per_element;
+  double estimate;
+  double exact;
+  double rel_error;
+};
+
+static void print_result(const Result& r, bool csv) {
+  if (csv) {
+    printf("%s,%s,%zu,%zu,%.2f,%.2f,%.2f,%.6g,%.6g,%.6g\n", r.estimator.c_str(), r.stream.c_str(), r.window,
+           r.samples, r.ns_per_add, r.ns_per_query, r.bytes_per_element, r.estimate, r.exact, r.rel_error);
+  } else {
+    printf(
+        "{\"estimator\":\"%s\",\"stream\":\"%s\",\"window\":%zu,\"samples\":%zu,\"ns_per_add\":%.2f,"
+        "\"ns_per_query\":%.2f,\"bytes_per_element\":%.2f,\"estimate\":%.6g,\"exact\":%.6g,"
+        "\"rel_error\":%.6g}\n",
+        r.estimator.c_str(), r.stream.c_str(), r.window, r.samples, r.ns_per_add, r.ns_per_query,
+        r.bytes_per_element, r.estimate, r.exact, r.rel_error);
+  }
+  fflush(stdout);
+}
+
+template <typename Estimator, typename Factory>
+static Result run(const char* name, Factory make, const std::string& stream, const std::vector<double>& values,
+                  size_t window, bool windowed, double percentile, int queries) {
+  size_t before = live_bytes;
+  Estimator* est = make();
+
+  auto t0 = Clock::now();
+  for (double v : values) est->add(v);
+  auto t1 = Clock::now();
+
+  double sink = 0;
+  for (int i = 0; i < queries; i++) sink += double(est->getPercentile());
+  auto t2 = Clock::now();
+
+  Result r;
+  r.estimator = name;
+  r.stream = stream;
+  r.window = window;
+  r.samples = values.size();
+  r.ns_per_add = double(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count()) /
+                 double(values.size());
+  r.ns_per_query =
+      double(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count()) / double(queries);
+  r.bytes_per_element = double(live_bytes - before) / double(windowed ? window : values.size());
+  r.estimate = sink / double(queries);
+  if (windowed) {
+    r.exact = exact_percentile(std::vector<double>(values.end() - long(window), values.end()), percentile);
+  } else {
+    r.exact = exact_percentile(values, percentile);
+  }
+  r.rel_error = r.exact != 0 ? std::fabs(r.estimate - r.exact) / std::fabs(r.exact) : std::fabs(r.estimate);
+  delete est;
+  return r;
+}
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("bench_percentile_buffer", "Benchmark PercentileBuffer and quantile estimators");
+  options.add_options()("w,windows", "Window sizes", cxxopts::value<std::vector<int>>()->default_value(
+                                                         "1000,100000,1000000"))(
+      "f,format", "Output format: json or csv", cxxopts::value<std::string>()->default_value("json"))(
+      "p,percentile", "Percentile to track", cxxopts::value<double>()->default_value("0.95"))(
+      "q,queries", "Queries per measurement", cxxopts::value<int>()->default_value("1000"))(
+      "s,seed", "Random seed", cxxopts::value<int>()->default_value("1"))("h,help", "Print usage");
+  auto parse = options.parse(argc, argv);
+  if (parse.count("help")) {
+    printf("%s\n", options.help().c_str());
+    return 0;
+  }
+
+  std::vector<int> windows;
+  std::string format;
+  int queries = 1000, seed = 1;
+  get_arg_vector(parse, "windows", windows);
+  get_arg_string(parse, "format", format);
+  get_arg_int(parse, "queries", queries);
+  get_arg_int(parse, "seed", seed);
+  const double percentile = parse["percentile"].as<double>();
+  const bool csv = format == "csv";
+
+  if (csv) {
+    printf(
+        "estimator,stream,window,samples,ns_per_add,ns_per_query,bytes_per_element,estimate,exact,"
+        "rel_error\n");
+  }
+
+  std::mt19937_64 gen{uint64_t(seed)};
+  for (int w : windows) {
+    const size_t window = size_t(w);
+    for (const char* stream : {"uniform", "zipf", "sorted", "adversarial"}) {
+      // Fill the window several times over, so eviction is part of the measurement
+      std::vector<double> values = make_stream(stream, window * 4, gen);
+      // Exact queries are O(window); keep their total cost bounded
+      const int exact_queries = std::max(1, int(std::min<size_t>(size_t(queries), 100000000 / (window * 4))));
+
+      print_result(run<PercentileBuffer<double>>(
+                       "PercentileBuffer", [&] { return new PercentileBuffer<double>(window, percentile); },
+                       stream, values, window, true, percentile, queries),
+                   csv);
+      print_result(run<ExactWindow>(
+                       "ExactWindow", [&] { return new ExactWindow(window, percentile); }, stream, values,
+                       window, true, percentile, exact_queries),
+                   csv);
+      print_result(run<DDSketch>(
+                       "DDSketch", [&] { return new DDSketch(0.01, percentile); }, stream, values, window,
+                       false, percentile, queries),
+                   csv);
+      print_result(run<KLLSketch<double>>(
+                       "KLLSketch", [&] { return new KLLSketch<double>(200, percentile); }, stream, values,
+                       window, false, percentile, exact_queries),
+                   csv);
+      print_result(run<P2Percentile>(
+                       "P2Percentile", [&] { return new P2Percentile(percentile); }, stream, values, window,
+                       false, percentile, queries),
+                   csv);
+      print_result(run<HistogramAdapter>(
+                       "LatencyHistogram", [&] { return new HistogramAdapter(percentile); }, stream, values,
+                       window, false, percentile, exact_queries),
+                   csv);
+    }
+  }
+  return 0;
+}
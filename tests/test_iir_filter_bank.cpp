@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <toolbox/iir_filter_bank.h>
+#include <toolbox/iir_smoother.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+static const IirFilterBank::Isa kIsas[] = {IirFilterBank::ISA_SCALAR, IirFilterBank::ISA_SSE,
+                                           IirFilterBank::ISA_AVX2};
+
+// Reference biquad in double, direct form I
+struct RefBiquad {
+  IirSection s;
+  double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+  double update(double x) {
+    double y = s.b0 * x + s.b1 * x1 + s.b2 * x2 - s.a1 * y1 - s.a2 * y2;
+    x2 = x1;
+    x1 = x;
+    y2 = y1;
+    y1 = y;
+    return y;
+  }
+};
+
+TEST(TestIirFilterBank, FirstOrderMatchesSmoother) {
+  // 37 channels: full AVX2 vectors, one SSE step and a scalar tail
+  const size_t n = 37;
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+  for (auto isa : kIsas) {
+    IirFilterBank bank(n, 0.2f);
+    bank.setIsa(isa);
+    std::vector<iir_smoother> ref(n, iir_smoother(0, 0.2));
+    std::vector<float> frame(n);
+    for (int t = 0; t < 200; t++) {
+      for (auto& v : frame) v = dist(gen);
+      std::vector<float> in = frame;
+      bank.update(frame.data(), frame.data());
+      for (size_t c = 0; c < n; c++) {
+        ASSERT_NEAR(frame[c], ref[c].update(in[c]), 1e-4) << "isa " << int(isa) << " channel " << c;
+      }
+    }
+  }
+}
+
+TEST(TestIirFilterBank, BiquadCascade) {
+  const size_t n = 21;
+  std::vector<IirSection> sections = {IirSection::lowPass(10.0, 200.0), IirSection::firstOrder(0.5f),
+                                      IirSection::highPass(1.0, 200.0)};
+  std::mt19937 gen(2);
+  std::normal_distribution<double> dist(0.0, 1.0);
+  for (auto isa : kIsas) {
+    IirFilterBank bank(n, sections);
+    bank.setIsa(isa);
+    std::vector<std::vector<RefBiquad>> lp(n, {RefBiquad{sections[0]}});
+    std::vector<iir_smoother> fo(n, iir_smoother(0, 0.5));
+    std::vector<std::vector<RefBiquad>> hp(n, {RefBiquad{sections[2]}});
+    std::vector<float> in(n), out(n);
+    for (int t = 0; t < 500; t++) {
+      for (auto& v : in) v = float(dist(gen));
+      bank.update(std::span<const float>(in), std::span<float>(out));
+      for (size_t c = 0; c < n; c++) {
+        double expected = hp[c][0].update(fo[c].update(lp[c][0].update(in[c])));
+        ASSERT_NEAR(out[c], expected, 1e-4) << "isa " << int(isa) << " channel " << c;
+      }
+    }
+  }
+}
+
+TEST(TestIirFilterBank, ResetSteadyState) {
+  const size_t n = 10;
+  IirFilterBank bank(n, {IirSection::lowPass(5.0, 100.0), IirSection::lowPass(5.0, 100.0)});
+  std::vector<float> values(n);
+  for (size_t c = 0; c < n; c++) values[c] = float(c) * 3.0f - 7.0f;
+  bank.reset(values.data());
+  std::vector<float> out(n);
+  for (int t = 0; t < 50; t++) {
+    bank.update(values.data(), out.data());
+    for (size_t c = 0; c < n; c++) {
+      ASSERT_NEAR(out[c], values[c], 1e-4);
+    }
+  }
+
+  // A high pass filter settles to zero for a constant input
+  IirFilterBank hp(n, {IirSection::highPass(5.0, 100.0)});
+  hp.reset(4.0f);
+  std::vector<float> fours(n, 4.0f);
+  hp.update(fours.data(), out.data());
+  for (size_t c = 0; c < n; c++) {
+    EXPECT_NEAR(out[c], 0.0f, 1e-5);
+  }
+  EXPECT_NEAR(IirSection::highPass(5.0, 100.0).dcGain(), 0.0, 1e-6);
+  EXPECT_NEAR(IirSection::lowPass(5.0, 100.0).dcGain(), 1.0, 1e-6);
+}
+
+TEST(TestIirFilterBank, LowPassAttenuates) {
+  // A 40Hz tone through a 5Hz low pass at 1kHz is attenuated by more than 30dB
+  IirFilterBank bank(8, {IirSection::lowPass(5.0, 1000.0), IirSection::lowPass(5.0, 1000.0)});
+  std::vector<float> frame(8);
+  double peak = 0;
+  for (int t = 0; t < 5000; t++) {
+    float x = float(std::sin(2.0 * M_PI * 40.0 * t / 1000.0));
+    std::fill(frame.begin(), frame.end(), x);
+    bank.update(frame.data(), frame.data());
+    if (t > 2000) peak = std::max(peak, double(std::fabs(frame[7])));
+  }
+  EXPECT_LT(peak, 0.03);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <toolbox/iir_smoother.h>
+
+#include <cmath>
+#include <vector>
+
+TEST(TestIirSmoother, Uniform) {
+  iir_smoother s(0, 0.25);
+  EXPECT_DOUBLE_EQ(s.update(4.0), 1.0);
+  EXPECT_DOUBLE_EQ(s(4.0), 1.75);
+}
+
+TEST(TestTimedIirSmoother, Approximations) {
+  timed_iir_smoother exact(2.0, timed_iir_smoother::EXP);
+  timed_iir_smoother poly(2.0, timed_iir_smoother::POLY);
+  timed_iir_smoother rational(2.0, timed_iir_smoother::RATIONAL);
+  for (double dt = 0.0; dt < 100.0; dt += 0.01) {
+    double a = exact.alpha(dt);
+    EXPECT_NEAR(a, 1.0 - std::exp(-dt / 2.0), 1e-12);
+    EXPECT_NEAR(poly.alpha(dt), a, 1e-6) << "dt " << dt;
+    EXPECT_LE(rational.alpha(dt), a + 1e-12);
+    EXPECT_GE(rational.alpha(dt), 0.0);
+    EXPECT_LT(rational.alpha(dt), 1.0);
+  }
+}
+
+TEST(TestTimedIirSmoother, IrregularSampling) {
+  // Splitting an interval into many samples of the same value gives the same result as one sample
+  timed_iir_smoother one(1.0);
+  timed_iir_smoother many(1.0);
+  one.update(0.0, 0.0);
+  many.update(0.0, 0.0);
+  one.update(10.0, 0.5);
+  for (int i = 1; i <= 50; i++) {
+    many.update(10.0, 0.01 * i);
+  }
+  EXPECT_NEAR(one.val_, many.val_, 1e-9);
+  EXPECT_NEAR(one.val_, 10.0 * (1.0 - std::exp(-0.5)), 1e-9);
+
+  // A sample after a long gap dominates; duplicate or older timestamps are ignored
+  one.update(-3.0, 100.0);
+  EXPECT_NEAR(one.val_, -3.0, 1e-9);
+  one.update(50.0, 100.0);
+  one.update(50.0, 99.0);
+  EXPECT_NEAR(one.val_, -3.0, 1e-9);
+}
+
+TEST(TestTimedIirSmoother, Batch) {
+  std::vector<double> values = {1.0, 2.0, 5.0, 3.0, 3.0, 8.0};
+  std::vector<double> times = {0.0, 0.1, 0.15, 0.9, 2.0, 2.01};
+  timed_iir_smoother single(0.5);
+  std::vector<double> expected;
+  for (size_t i = 0; i < values.size(); i++) {
+    expected.push_back(single.update(values[i], times[i]));
+  }
+  timed_iir_smoother batch(0.5);
+  std::vector<double> out(values.size());
+  EXPECT_DOUBLE_EQ(batch.update(values, times, out), expected.back());
+  for (size_t i = 0; i < values.size(); i++) {
+    EXPECT_DOUBLE_EQ(out[i], expected[i]);
+  }
+  batch.reset();
+  EXPECT_DOUBLE_EQ(batch.update(values, times), expected.back());
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "toolbox/latency_histogram.h"
+
+TEST(LatencyHistogramTest, EmptyTest) {
+  LatencyHistogram hist;
+  auto s = hist.snapshot();
+  ASSERT_TRUE(s.empty());
+  ASSERT_EQ(s.count(), 0);
+  ASSERT_EQ(s.getPercentile(0.99), 0);
+  ASSERT_EQ(s.mean(), 0.0);
+}
+
+TEST(LatencyHistogramTest, BucketBoundsTest) {
+  LatencyHistogram hist(1000000000ull, 8);
+  for (uint64_t v : {0ull, 1ull, 255ull, 256ull, 257ull, 1000ull, 123456789ull}) {
+    size_t i = hist.bucketIndex(v);
+    EXPECT_LE(LatencyHistogram::bucketLowest(i, 8), v);
+    EXPECT_GE(LatencyHistogram::bucketHighest(i, 8), v);
+  }
+  // Consecutive buckets tile the value range
+  for (size_t i = 0; i + 1 < hist.bucketCount(); i++) {
+    ASSERT_EQ(LatencyHistogram::bucketHighest(i, 8) + 1, LatencyHistogram::bucketLowest(i + 1, 8));
+  }
+  // Values past the range land in the last bucket
+  EXPECT_EQ(hist.bucketIndex(UINT64_MAX), hist.bucketCount() - 1);
+}
+
+TEST(LatencyHistogramTest, PercentileTest) {
+  LatencyHistogram hist;
+  std::vector<uint64_t> values;
+  std::mt19937 gen(1);
+  std::lognormal_distribution<double> dist(12.0, 1.5);
+  for (int i = 0; i < 100000; i++) {
+    uint64_t v = uint64_t(dist(gen));
+    values.push_back(v);
+    hist.record(v);
+  }
+  auto s = hist.snapshot();
+  ASSERT_EQ(s.count(), values.size());
+  std::sort(values.begin(), values.end());
+  for (double q : {0.5, 0.9, 0.99, 0.999}) {
+    double exact = double(values[size_t(q * double(values.size() - 1))]);
+    EXPECT_NEAR(double(s.getPercentile(q)), exact, exact / 128.0) << "q=" << q;
+  }
+  EXPECT_EQ(s.min(), values.front());
+  EXPECT_EQ(s.max(), values.back());
+  EXPECT_EQ(s.getPercentile(1.0), values.back());
+
+  hist.reset();
+  ASSERT_TRUE(hist.snapshot().empty());
+}
+
+TEST(LatencyHistogramTest, MeanTest) {
+  LatencyHistogram hist;
+  for (uint64_t i = 1; i <= 100; i++) {
+    hist.record(i);
+  }
+  hist.recordSeconds(0.000001);  // 1000ns
+  auto s = hist.snapshot();
+  EXPECT_EQ(s.count(), 101);
+  EXPECT_DOUBLE_EQ(s.mean(), (5050.0 + 1000.0) / 101.0);
+  EXPECT_EQ(s.getPercentile(0.5), 51);
+  EXPECT_EQ(s.max(), 1000);
+}
+
+TEST(LatencyRecorderTest, PerThreadTest) {
+  LatencyRecorder recorder;
+  constexpr int kThreads = 4;
+  constexpr uint64_t kSamples = 50000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&recorder, t]() {
+      for (uint64_t i = 0; i < kSamples; i++) {
+        recorder.record(uint64_t(t) * 1000 + i % 100);
+      }
+    });
+  }
+  // Reading while recording is allowed
+  auto partial = recorder.snapshot();
+  EXPECT_LE(partial.count(), kThreads * kSamples);
+  for (auto& t : threads) {
+    t.join();
+  }
+  auto s = recorder.snapshot();
+  EXPECT_EQ(s.count(), kThreads * kSamples);
+  EXPECT_EQ(s.min(), 0);
+  EXPECT_EQ(s.max(), 3099);
+
+  recorder.reset();
+  EXPECT_TRUE(recorder.snapshot().empty());
+}
+
+TEST(LatencyRecorderTest, ManyRecordersTest) {
+  // More recorders than the thread cache holds, alternating: each keeps its own samples
+  constexpr size_t kRecorders = 9;
+  std::vector<std::unique_ptr<LatencyRecorder>> recorders;
+  for (size_t r = 0; r < kRecorders; r++) {
+    recorders.push_back(std::make_unique<LatencyRecorder>());
+  }
+  for (uint64_t i = 0; i < 1000; i++) {
+    for (size_t r = 0; r < kRecorders; r++) {
+      recorders[r]->record(r);
+    }
+  }
+  for (size_t r = 0; r < kRecorders; r++) {
+    auto s = recorders[r]->snapshot();
+    EXPECT_EQ(s.count(), 1000);
+    EXPECT_EQ(s.max(), r);
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
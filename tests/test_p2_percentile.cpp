@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "toolbox/p2_percentile.h"
+#include "toolbox/quantile_sketch.h"
+
+static_assert(PercentileEstimator<P2Percentile>);
+
+TEST(P2PercentileTest, EmptyTest) {
+  P2Percentile est;
+  ASSERT_TRUE(est.empty());
+  ASSERT_EQ(est.getPercentile(), 0.0);
+  ASSERT_EQ(est.getPercentileParameter(), 0.95);
+}
+
+TEST(P2PercentileTest, FirstSamplesExactTest) {
+  P2Percentile est(0.5);
+  est.add(3.0);
+  ASSERT_DOUBLE_EQ(est.getPercentile(), 3.0);
+  est.add(1.0);
+  est.add(2.0);
+  ASSERT_DOUBLE_EQ(est.getPercentile(), 2.0);
+  est.add(5.0);
+  est.add(4.0);
+  ASSERT_EQ(est.size(), 5);
+  ASSERT_DOUBLE_EQ(est.getPercentile(), 3.0);
+}
+
+TEST(P2PercentileTest, UniformTest) {
+  P2Percentile est({0.95, 0.5, 0.99});
+  ASSERT_EQ(est.numPercentiles(), 3);
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<double> dist(0.0, 100.0);
+  for (int i = 0; i < 100000; i++) {
+    est.add(dist(gen));
+  }
+  EXPECT_NEAR(est.getPercentile(), 95.0, 0.5);
+  EXPECT_NEAR(est.getPercentileAt(1), 50.0, 0.5);
+  EXPECT_NEAR(est.getPercentileAt(2), 99.0, 0.5);
+}
+
+TEST(P2PercentileTest, SkewedTest) {
+  P2Percentile est(0.95);
+  std::vector<double> values;
+  std::mt19937 gen(5);
+  std::exponential_distribution<double> dist(1.0);
+  for (int i = 0; i < 100000; i++) {
+    double v = dist(gen);
+    values.push_back(v);
+    est.add(v);
+  }
+  std::sort(values.begin(), values.end());
+  double exact = values[size_t(0.95 * double(values.size() - 1))];
+  EXPECT_NEAR(est.getPercentile(), exact, exact * 0.02);
+}
+
+TEST(P2PercentileTest, ResetTest) {
+  P2Percentile est(0.5);
+  for (int i = 0; i < 100; i++) {
+    est.add(double(i));
+  }
+  est.reset();
+  ASSERT_TRUE(est.empty());
+  est.setPercentileParameter(0.9);
+  ASSERT_EQ(est.getPercentileParameter(), 0.9);
+  for (int i = 1; i <= 1000; i++) {
+    est.add(double(i));
+  }
+  EXPECT_NEAR(est.getPercentile(), 900.0, 10.0);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
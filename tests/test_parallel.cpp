@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include <toolbox/parallel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+TEST(TestParallel, For) {
+  ThreadPool pool("parallel", 4);
+  pool.Start();
+  std::vector<int> hits(10007, 0);
+  ParallelFor(0, int(hits.size()), 0, [&](int i) { hits[size_t(i)]++; }, pool);
+  EXPECT_TRUE(std::all_of(hits.begin(), hits.end(), [](int h) { return h == 1; }));
+
+  // Chunks cover the range exactly
+  std::atomic<int> nChunks(0);
+  std::atomic<int> nCovered(0);
+  ParallelForRange(
+      10, 1010, 64,
+      [&](int b, int e) {
+        EXPECT_LE(e - b, 64);
+        nChunks++;
+        nCovered += e - b;
+      },
+      pool);
+  EXPECT_EQ(nChunks, 16);
+  EXPECT_EQ(nCovered, 1000);
+
+  // Nothing to do
+  ParallelFor(5, 5, 0, [](int) { FAIL(); }, pool);
+}
+
+TEST(TestParallel, NestedAndShared) {
+  // Nested loops run on the shared pool without deadlocking, whatever its size
+  std::vector<std::atomic<int>> sums(64);
+  ParallelFor(0, sums.size(), 1, [&](size_t i) {
+    ParallelFor(0, 1000, 10, [&](int j) { sums[i] += j; });
+  });
+  for (auto& sum : sums) EXPECT_EQ(sum, 499500);
+}
+
+TEST(TestParallel, Reduce) {
+  ThreadPool pool("parallel", 3);
+  pool.Start();
+  std::vector<uint64_t> values(100000);
+  std::iota(values.begin(), values.end(), 1);
+  uint64_t sum = ParallelReduce(
+      0, values.size(), 0, uint64_t(0),
+      [&](size_t b, size_t e, uint64_t acc) {
+        for (; b < e; b++) acc += values[b];
+        return acc;
+      },
+      std::plus<uint64_t>(), pool);
+  EXPECT_EQ(sum, 100000ull * 100001ull / 2);
+
+  // Chunk results are combined in order
+  std::string letters = ParallelReduce(
+      0, 26, 3, std::string(),
+      [](int b, int e, std::string acc) {
+        for (; b < e; b++) acc += char('a' + b);
+        return acc;
+      },
+      [](std::string a, const std::string& b) { return a + b; }, pool);
+  EXPECT_EQ(letters, "abcdefghijklmnopqrstuvwxyz");
+}
+
+TEST(TestParallel, Transform) {
+  std::vector<int> in(5000);
+  std::iota(in.begin(), in.end(), 0);
+  std::vector<std::string> out(in.size());
+  auto toString = [](int v) { return std::to_string(v * 2); };
+  auto end = ParallelTransform(in.begin(), in.end(), out.begin(), toString);
+  EXPECT_EQ(end, out.end());
+  for (size_t i = 0; i < in.size(); i++) ASSERT_EQ(out[i], std::to_string(i * 2));
+}
+
+TEST(TestParallel, Sort) {
+  ThreadPool pool("parallel", 4);
+  pool.Start();
+  std::mt19937 rng(7);
+  for (size_t n : {0, 1, 1000, 100000, 123457}) {
+    std::vector<uint32_t> values(n);
+    for (auto& v : values) v = rng();
+    std::vector<uint32_t> expected = values;
+    std::sort(expected.begin(), expected.end());
+    ParallelSort(values.begin(), values.end(), std::less<>(), pool);
+    EXPECT_EQ(values, expected);
+  }
+
+  // Stable, with a custom comparison
+  std::vector<std::pair<int, int>> pairs(50000);
+  for (size_t i = 0; i < pairs.size(); i++) pairs[i] = {int(rng() % 100), int(i)};
+  std::vector<std::pair<int, int>> expected = pairs;
+  auto byKey = [](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first > b.first; };
+  std::stable_sort(expected.begin(), expected.end(), byKey);
+  ParallelSort(pairs.begin(), pairs.end(), byKey, pool);
+  EXPECT_EQ(pairs, expected);
+}
+
+TEST(TestParallel, Exceptions) {
+  ThreadPool pool("parallel", 2);
+  pool.Start();
+  std::atomic<int> nRan(0);
+  EXPECT_THROW(ParallelFor(
+                   0, 1000, 1,
+                   [&](int i) {
+                     nRan++;
+                     if (i == 10) throw std::runtime_error("chunk failed");
+                   },
+                   pool),
+               std::runtime_error);
+  EXPECT_LT(nRan, 1000);
+  pool.WaitIdle();
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
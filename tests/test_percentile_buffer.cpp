@@ -1,7 +1,24 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
 #include "toolbox/percentile_buffer.h"
 
+// Count global heap allocations, to check the buffer's steady state does none
+static std::atomic<size_t> allocation_count(0);
+
+void* operator new(size_t size) {
+  allocation_count++;
+  void* p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
 template <class T>
 void print_buffer(const PercentileBuffer<T>& buffer) {
   // print Buffer elements using advance iterator
@@ -272,6 +289,65 @@ TEST(PercentileBufferTest, ConstIteratorTest) {
   }
 }
 
+TEST(PercentileBufferTest, NoAllocationTest) {
+  PercentileBuffer<double> buffer(1000);
+  // The first add allocates the node pool
+  buffer.add(0.0);
+  size_t before = allocation_count;
+  for (int i = 1; i < 100000; ++i) {
+    buffer.add(double((i * 7919) % 1000));
+  }
+  ASSERT_EQ(allocation_count - before, 0);
+  ASSERT_EQ(buffer.size(), 1000);
+  ASSERT_TRUE(buffer.full());
+
+  buffer.setPercentileParameter(0.5);
+  buffer.reset();
+  for (int i = 0; i < 2000; ++i) {
+    buffer.add(double(i));
+  }
+  ASSERT_EQ(allocation_count - before, 0);
+}
+
+TEST(PercentileBufferTest, PercentileOneTest) {
+  PercentileBuffer<double> buffer(10, 1.0);
+  for (int i = 1; i <= 20; ++i) {
+    buffer.add(i);
+  }
+  ASSERT_EQ(buffer.size(), 10);
+  ASSERT_DOUBLE_EQ(buffer.getPercentile(), 20.0);
+}
+
+TEST(PercentileBufferTest, CopyMoveTest) {
+  PercentileBuffer<double> buffer(100);
+  for (int i = 1; i <= 100; ++i) {
+    buffer.add(i);
+  }
+
+  PercentileBuffer<double> copy(buffer);
+  ASSERT_EQ(copy.size(), 100);
+  ASSERT_DOUBLE_EQ(copy.getPercentile(), 95.0);
+  copy.add(1000.0);
+  ASSERT_DOUBLE_EQ(copy.getPercentile(), 96.0);
+  ASSERT_DOUBLE_EQ(buffer.getPercentile(), 95.0);
+
+  PercentileBuffer<double> moved(std::move(copy));
+  ASSERT_EQ(moved.size(), 100);
+  ASSERT_DOUBLE_EQ(moved.getPercentile(), 96.0);
+
+  PercentileBuffer<double> assigned(10);
+  assigned.add(1.0);
+  assigned = buffer;
+  ASSERT_EQ(assigned.maxSize(), 100);
+  ASSERT_DOUBLE_EQ(assigned.getPercentile(), 95.0);
+  assigned = std::move(moved);
+  ASSERT_DOUBLE_EQ(assigned.getPercentile(), 96.0);
+  for (int i = 0; i < 200; ++i) {
+    assigned.add(i);
+  }
+  ASSERT_DOUBLE_EQ(assigned.getPercentile(), 195.0);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,219 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "toolbox/quantile_sketch.h"
+
+template <class T>
+static T exact_quantile(std::vector<T> values, double q) {
+  size_t k = size_t(q * double(values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + long(k), values.end());
+  return values[k];
+}
+
+TEST(DDSketchTest, EmptyTest) {
+  DDSketch sketch;
+  ASSERT_TRUE(sketch.empty());
+  ASSERT_EQ(sketch.size(), 0);
+  ASSERT_EQ(sketch.getPercentile(), 0.0);
+  ASSERT_EQ(sketch.getPercentileParameter(), 0.95);
+}
+
+TEST(DDSketchTest, RelativeErrorTest) {
+  DDSketch sketch(0.01);
+  std::vector<double> values;
+  std::mt19937 gen(42);
+  std::lognormal_distribution<double> dist(0.0, 2.0);
+  for (int i = 0; i < 100000; i++) {
+    double v = dist(gen);
+    values.push_back(v);
+    sketch.add(v);
+  }
+  ASSERT_EQ(sketch.size(), values.size());
+  for (double q : {0.01, 0.25, 0.5, 0.9, 0.95, 0.99, 0.999}) {
+    double exact = exact_quantile(values, q);
+    EXPECT_NEAR(sketch.getQuantile(q), exact, exact * 0.01) << "q=" << q;
+  }
+  EXPECT_EQ(sketch.getQuantile(0.0), *std::min_element(values.begin(), values.end()));
+  EXPECT_EQ(sketch.getQuantile(1.0), *std::max_element(values.begin(), values.end()));
+}
+
+TEST(DDSketchTest, NegativeAndZeroTest) {
+  DDSketch sketch(0.01, 0.5);
+  for (int i = -100; i <= 100; i++) {
+    sketch.add(double(i));
+  }
+  EXPECT_DOUBLE_EQ(sketch.getPercentile(), 0.0);
+  EXPECT_NEAR(sketch.getQuantile(0.25), -50.0, 0.5);
+  EXPECT_NEAR(sketch.getQuantile(0.75), 50.0, 0.5);
+  EXPECT_DOUBLE_EQ(sketch.min(), -100.0);
+  EXPECT_DOUBLE_EQ(sketch.max(), 100.0);
+}
+
+TEST(DDSketchTest, MergeTest) {
+  DDSketch a, b, all;
+  for (int i = 1; i <= 1000; i++) {
+    (i % 2 ? a : b).add(double(i));
+    all.add(double(i));
+  }
+  ASSERT_TRUE(a.merge(b));
+  ASSERT_EQ(a.size(), 1000);
+  for (double q : {0.1, 0.5, 0.95, 0.99}) {
+    EXPECT_DOUBLE_EQ(a.getQuantile(q), all.getQuantile(q));
+  }
+
+  DDSketch other_accuracy(0.05);
+  other_accuracy.add(1.0);
+  ASSERT_FALSE(a.merge(other_accuracy));
+  ASSERT_EQ(a.size(), 1000);
+}
+
+TEST(DDSketchTest, BoundedMemoryTest) {
+  DDSketch sketch(0.01, 0.95, 64);
+  for (int i = 0; i < 100000; i++) {
+    sketch.add(1e-6 * std::pow(1.001, i % 20000));
+  }
+  ASSERT_LE(sketch.memoryUsage(), 2 * 64 * sizeof(uint64_t));
+  // The top of the distribution keeps its accuracy
+  double exact = 1e-6 * std::pow(1.001, 19999);
+  EXPECT_NEAR(sketch.getQuantile(0.9999), exact, exact * 0.01);
+}
+
+TEST(DDSketchTest, SerializeTest) {
+  DDSketch sketch(0.02, 0.99);
+  for (int i = 1; i <= 1000; i++) {
+    sketch.add(double(i) - 10.0);
+  }
+  std::vector<uint8_t> buf = sketch.serialize();
+  DDSketch copy;
+  ASSERT_TRUE(DDSketch::deserialize(buf, copy));
+  EXPECT_EQ(copy.size(), sketch.size());
+  EXPECT_EQ(copy.getPercentileParameter(), 0.99);
+  EXPECT_EQ(copy.relativeAccuracy(), 0.02);
+  EXPECT_DOUBLE_EQ(copy.getPercentile(), sketch.getPercentile());
+  EXPECT_DOUBLE_EQ(copy.getQuantile(0.1), sketch.getQuantile(0.1));
+
+  buf.resize(buf.size() / 2);
+  ASSERT_FALSE(DDSketch::deserialize(buf, copy));
+  ASSERT_EQ(copy.size(), sketch.size());
+}
+
+TEST(DDSketchTest, HostileOffsetTest) {
+  DDSketch sketch;
+  sketch.add(1.0);
+  sketch.add(2.0);
+  std::vector<uint8_t> buf = sketch.serialize();
+  // The offset of the positive buckets, after the magic, 3 parameters and 5 statistics
+  const size_t offset_pos = sizeof(uint32_t) + 8 * sizeof(uint64_t);
+  for (int32_t offset : {std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::min()}) {
+    std::memcpy(buf.data() + offset_pos, &offset, sizeof(offset));
+    DDSketch copy;
+    ASSERT_FALSE(DDSketch::deserialize(buf, copy));
+  }
+}
+
+TEST(DDSketchTest, ExtremeValuesTest) {
+  // Keys out of the int32 range are clamped, rather than overflow
+  DDSketch sketch(1e-9);
+  sketch.add(std::numeric_limits<double>::max());
+  sketch.add(std::numeric_limits<double>::infinity());
+  sketch.add(-std::numeric_limits<double>::infinity());
+  sketch.add(1.0);
+  EXPECT_EQ(sketch.size(), 4);
+  EXPECT_EQ(sketch.max(), std::numeric_limits<double>::infinity());
+  EXPECT_EQ(sketch.getQuantile(1.0), std::numeric_limits<double>::infinity());
+}
+
+TEST(KLLSketchTest, RankErrorTest) {
+  KLLSketch<double> sketch(200);
+  std::vector<double> values;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> dist(0.0, 1000.0);
+  for (int i = 0; i < 200000; i++) {
+    double v = dist(gen);
+    values.push_back(v);
+    sketch.add(v);
+  }
+  ASSERT_EQ(sketch.size(), values.size());
+  ASSERT_LT(sketch.retained(), 1000);
+  std::sort(values.begin(), values.end());
+  for (double q : {0.05, 0.5, 0.95, 0.99}) {
+    double v = sketch.getQuantile(q);
+    double rank = double(std::lower_bound(values.begin(), values.end(), v) - values.begin()) / values.size();
+    EXPECT_NEAR(rank, q, 0.02) << "q=" << q;
+  }
+}
+
+TEST(KLLSketchTest, SmallExactTest) {
+  // Below capacity, the sketch is exact and agrees with PercentileBuffer
+  KLLSketch<double> sketch;
+  PercentileBuffer<double> buffer(100);
+  for (int i = 1; i <= 100; ++i) {
+    sketch.add(double(i));
+    buffer.add(double(i));
+  }
+  ASSERT_DOUBLE_EQ(sketch.getPercentile(), buffer.getPercentile());
+  sketch.setPercentileParameter(0.5);
+  buffer.setPercentileParameter(0.5);
+  ASSERT_DOUBLE_EQ(sketch.getPercentile(), buffer.getPercentile());
+}
+
+TEST(KLLSketchTest, MergeAndSerializeTest) {
+  std::vector<KLLSketch<int>> workers(4);
+  for (int i = 0; i < 100000; i++) {
+    workers[size_t(i % 4)].add(i);
+  }
+  KLLSketch<int> total;
+  for (const auto& w : workers) {
+    std::vector<uint8_t> buf = w.serialize();
+    KLLSketch<int> copy;
+    ASSERT_TRUE(KLLSketch<int>::deserialize(buf, copy));
+    ASSERT_EQ(copy.size(), w.size());
+    ASSERT_TRUE(total.merge(copy));
+  }
+  ASSERT_EQ(total.size(), 100000);
+  EXPECT_EQ(total.min(), 0);
+  EXPECT_EQ(total.max(), 99999);
+  EXPECT_NEAR(total.getPercentile(), 95000, 2000);
+
+  KLLSketch<double> wrong_type;
+  ASSERT_FALSE(KLLSketch<double>::deserialize(workers[0].serialize(), wrong_type));
+}
+
+TEST(KLLSketchTest, HostileLevelSizeTest) {
+  KLLSketch<int> sketch;
+  for (int i = 0; i < 3; i++) {
+    sketch.add(i);
+  }
+  std::vector<uint8_t> buf = sketch.serialize();
+  // The size of the only level, made to wrap around when multiplied by sizeof(int)
+  uint64_t n = (uint64_t(1) << 62) + 3;
+  std::memcpy(buf.data() + buf.size() - 3 * sizeof(int) - sizeof(n), &n, sizeof(n));
+  KLLSketch<int> copy;
+  ASSERT_FALSE(KLLSketch<int>::deserialize(buf, copy));
+}
+
+template <PercentileEstimator E>
+static double fill_and_query(E& estimator) {
+  for (int i = 1; i <= 100; i++) {
+    estimator.add(double(i));
+  }
+  return double(estimator.getPercentile());
+}
+
+TEST(PercentileEstimatorTest, CommonInterfaceTest) {
+  PercentileBuffer<double> buffer(100);
+  DDSketch dd;
+  KLLSketch<double> kll;
+  EXPECT_DOUBLE_EQ(fill_and_query(buffer), 95.0);
+  EXPECT_NEAR(fill_and_query(dd), 95.0, 95.0 * 0.01);
+  EXPECT_DOUBLE_EQ(fill_and_query(kll), 95.0);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,11 @@
 #include <gtest/gtest.h>
 #include <toolbox/rate.h>
+#include <toolbox/rate_table.h>
+#include <toolbox/striped_rate.h>
+
+#include <cmath>
+#include <thread>
+#include <vector>
 
 TEST(TestRateToolbox, RateTest) {
   {
@@ -71,6 +77,121 @@ TEST(TestRateToolbox, RateTest) {
   }
 }
 
+TEST(TestRateToolbox, EwmaRateTest) {
+  Rate rate;
+  EXPECT_EQ(rate.getEwmaRate(Rate::EWMA_1S), 0.0);
+  // 10 counts per second, sampled every 100ms for 10 minutes
+  for (int i = 0; i <= 6000; i++) {
+    rate.addPoint(size_t(i), double(i) / 10.0);
+  }
+  EXPECT_NEAR(rate.getRate(), 10.0, 1e-9);
+  EXPECT_NEAR(rate.getEwmaRate(Rate::EWMA_1S), 10.0, 1e-6);
+  EXPECT_NEAR(rate.getEwmaRate(Rate::EWMA_10S), 10.0, 1e-6);
+  EXPECT_NEAR(rate.getEwmaRate(Rate::EWMA_60S), 10.0, 1e-3);
+
+  // The counter stops for 5 seconds: the averages decay with their time constants
+  for (int i = 1; i <= 50; i++) {
+    rate.addPoint(6000, 600.0 + double(i) / 10.0);
+  }
+  EXPECT_NEAR(rate.getEwmaRate(Rate::EWMA_1S), 10.0 * std::exp(-5.0), 1e-3);
+  EXPECT_NEAR(rate.getEwmaRate(Rate::EWMA_10S), 10.0 * std::exp(-0.5), 1e-3);
+  EXPECT_NEAR(rate.getEwmaRate(Rate::EWMA_60S), 10.0 * std::exp(-5.0 / 60.0), 1e-2);
+
+  // No new point: the average only decays when read with the current time
+  const double ewma_1s = rate.getEwmaRate(Rate::EWMA_1S);
+  EXPECT_EQ(rate.getEwmaRate(Rate::EWMA_1S, 605.0), ewma_1s);
+  EXPECT_NEAR(rate.getEwmaRate(Rate::EWMA_1S, 607.0), ewma_1s * std::exp(-2.0), 1e-9);
+  EXPECT_NEAR(rate.getEwmaRate(Rate::EWMA_10S, 615.0), 10.0 * std::exp(-1.5), 1e-3);
+  EXPECT_EQ(rate.getEwmaRate(Rate::EWMA_1S), ewma_1s);
+}
+
+TEST(TestRateToolbox, EpochTimeTest) {
+  // Large absolute times must not cost precision
+  Rate rate(1.0);
+  for (int i = 0; i < 100000; i++) {
+    rate.addPoint(size_t(i) * 3, 1.7e9 + double(i) * 0.001);
+  }
+  EXPECT_NEAR(rate.getRate(), 3000.0, 1e-2);
+}
+
+TEST(TestRateToolbox, StripedRateTest) {
+  StripedRate rate(5.0, 3);
+  EXPECT_EQ(rate.numStripes(), 4);
+  EXPECT_EQ(rate.total(), 0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&rate]() {
+      for (int i = 0; i < 100000; i++) {
+        rate.add();
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(rate.total(), 800000);
+
+  // Same window semantics as Rate
+  StripedRate sampled;
+  for (int i = 0; i < 10; i++) {
+    sampled.sample(double(i));
+    sampled.add(100);
+  }
+  EXPECT_EQ(sampled.getRate(), 100.0);
+  EXPECT_GT(sampled.getEwmaRate(Rate::EWMA_1S), 99.0);
+}
+
+TEST(TestRateToolbox, RateTableTest) {
+  RateTable table(5.0);
+  EXPECT_EQ(table.size(), 0);
+  EXPECT_EQ(table.getRate(3), 0.0);
+
+  // id 0 at 10/s, id 1 at 100/s, id 2 constant, id 3 only updated once
+  std::vector<uint32_t> ids = {0, 1, 2};
+  std::vector<size_t> nums(3);
+  table.addPoint(3, 1000, 0.0);
+  for (int i = 0; i <= 200; i++) {
+    nums = {size_t(i), size_t(i) * 10, 42};
+    table.addPoints(ids, nums, double(i) / 10.0);
+  }
+  EXPECT_EQ(table.size(), 4);
+  EXPECT_NEAR(table.getRate(0), 10.0, 1e-9);
+  EXPECT_NEAR(table.getRate(1), 100.0, 1e-9);
+  EXPECT_EQ(table.getRate(2), 0.0);
+  EXPECT_EQ(table.getRate(3), 0.0);
+
+  std::vector<double> rates;
+  table.getRates(rates);
+  ASSERT_EQ(rates.size(), 4);
+  EXPECT_NEAR(rates[0], 10.0, 1e-9);
+  EXPECT_NEAR(rates[1], 100.0, 1e-9);
+
+  // A new id gets no spurious rate from its first point
+  table.addPoint(100, 5000, 20.1);
+  EXPECT_EQ(table.size(), 101);
+  EXPECT_EQ(table.getRate(100), 0.0);
+
+  // id 1 stops counting: its rate decays to zero once the window has moved past
+  for (int i = 202; i <= 300; i++) {
+    table.addPoint(0, size_t(i), double(i) / 10.0);
+  }
+  EXPECT_NEAR(table.getRate(0), 10.0, 1e-9);
+  EXPECT_EQ(table.getRate(1), 0.0);
+
+  // Growth by points is bounded: a stray id is ignored instead of allocating 4G counters
+  EXPECT_EQ(table.addPoint(0xFFFFFFFF, 1, 30.1), 1);
+  EXPECT_EQ(table.size(), 101);
+  table.setMaxIds(200);
+  std::vector<uint32_t> far_ids = {150, 250, 5};
+  std::vector<size_t> far_nums = {1, 2, 3};
+  EXPECT_EQ(table.addPoints(far_ids, far_nums, 30.2), 1);
+  EXPECT_EQ(table.size(), 151);
+  // An explicit resize may go further
+  table.resize(300);
+  EXPECT_EQ(table.addPoint(250, 2, 30.3), 0);
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
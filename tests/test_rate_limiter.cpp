@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include <toolbox/rate_limiter.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static constexpr int64_t kSecond = 1000000000;
+
+TEST(TestRateLimiter, TokenBucketBurst) {
+  TokenBucket bucket(10.0, 5.0);
+  int64_t t = TokenBucket::now();
+  EXPECT_NEAR(bucket.available(t), 5.0, 1e-6);
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(bucket.tryAcquire(1.0, t));
+  }
+  EXPECT_FALSE(bucket.tryAcquire(1.0, t));
+
+  // 100ms later one token is back
+  t += kSecond / 10;
+  EXPECT_TRUE(bucket.tryAcquire(1.0, t));
+  EXPECT_FALSE(bucket.tryAcquire(1.0, t));
+
+  // After a long idle time, the bucket is full but holds no more than the burst
+  t += 100 * kSecond;
+  EXPECT_NEAR(bucket.available(t), 5.0, 1e-6);
+  EXPECT_FALSE(bucket.tryAcquire(6.0, t));
+  EXPECT_TRUE(bucket.tryAcquire(5.0, t));
+}
+
+TEST(TestRateLimiter, TokenBucketReserve) {
+  TokenBucket bucket(100.0, 1.0);
+  int64_t t = TokenBucket::now();
+  EXPECT_EQ(bucket.reserve(1.0, t), 0);
+  // Each following reservation waits one more interval
+  EXPECT_EQ(bucket.reserve(1.0, t), kSecond / 100);
+  EXPECT_EQ(bucket.reserve(1.0, t), 2 * kSecond / 100);
+  EXPECT_NEAR(bucket.available(t), -2.0, 1e-6);
+  EXPECT_FALSE(bucket.tryAcquire(1.0, t + kSecond / 100));
+}
+
+TEST(TestRateLimiter, SlowRates) {
+  // Raised to one operation every 31 years, the nanosecond arithmetic stays finite
+  TokenBucket bucket(1e-15, 1e9);
+  GcraLimiter gcra(1e-15, 1e9);
+  EXPECT_DOUBLE_EQ(bucket.rate(), 1e-9);
+  EXPECT_DOUBLE_EQ(gcra.rate(), 1e-9);
+  int64_t t = TokenBucket::now();
+  EXPECT_TRUE(bucket.tryAcquire(1.0, t));
+  EXPECT_FALSE(bucket.tryAcquire(1.0, t + kSecond));
+  EXPECT_TRUE(gcra.tryAcquire(1.0, t));
+  EXPECT_FALSE(gcra.tryAcquire(1.0, t + kSecond));
+}
+
+TEST(TestRateLimiter, GcraBurst) {
+  GcraLimiter gcra(10.0, 3.0);
+  int64_t t = TokenBucket::now();
+  EXPECT_TRUE(gcra.tryAcquire(1.0, t));
+  EXPECT_TRUE(gcra.tryAcquire(1.0, t));
+  EXPECT_TRUE(gcra.tryAcquire(1.0, t));
+  EXPECT_FALSE(gcra.tryAcquire(1.0, t));
+  t += kSecond / 10;
+  EXPECT_TRUE(gcra.tryAcquire(1.0, t));
+  EXPECT_FALSE(gcra.tryAcquire(1.0, t));
+  EXPECT_EQ(gcra.reserve(1.0, t), kSecond / 10);
+}
+
+TEST(TestRateLimiter, ConcurrentTryAcquire) {
+  // Many threads racing for 1000 tokens: exactly 1000 succeed
+  TokenBucket bucket(1e-3, 1000.0);
+  std::atomic<int> granted(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < 1000; j++) {
+        if (bucket.tryAcquire()) granted++;
+      }
+    });
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+  EXPECT_EQ(granted, 1000);
+}
+
+TEST(TestRateLimiter, BlockingAcquire) {
+  GcraLimiter gcra(200.0, 1.0);
+  int64_t t0 = TokenBucket::now();
+  for (int i = 0; i < 11; i++) {
+    gcra.acquire();
+  }
+  int64_t elapsed = TokenBucket::now() - t0;
+  // 10 intervals of 5ms after the first token
+  EXPECT_GE(elapsed, 45 * kSecond / 1000);
+  EXPECT_LT(elapsed, kSecond);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
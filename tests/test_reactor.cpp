@@ -0,0 +1,226 @@
+#include <gtest/gtest.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <toolbox/reactor.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class TestReactor : public ::testing::Test {
+protected:
+  void SetUp() override {
+    reactor.Start();
+    worker.Start();
+  }
+  void TearDown() override {
+    TaskThread::SetGlobalQuit(true);
+    reactor.join();
+    worker.join();
+    TaskThread::SetGlobalQuit(false);
+  }
+
+  Reactor reactor{"reactor"};
+  WorkerThread worker{"worker"};
+};
+
+static void Signal(int fd) {
+  uint64_t nValue = 1;
+  ASSERT_EQ(write(fd, &nValue, sizeof(nValue)), ssize_t(sizeof(nValue)));
+}
+
+TEST_F(TestReactor, LevelTriggeredOnWorker) {
+  int pipeFds[2];
+  ASSERT_EQ(pipe(pipeFds), 0);
+  std::atomic<int> nBytes(0);
+  std::promise<void> done;
+  // The handler reads one byte per call: the fd is re-armed until the pipe is empty
+  ASSERT_TRUE(reactor.AddFd(
+      pipeFds[0], EPOLLIN,
+      [&](int fd, uint32_t events) {
+        EXPECT_EQ(std::this_thread::get_id(), worker.get_id());
+        EXPECT_TRUE(events & EPOLLIN);
+        char c;
+        ASSERT_EQ(read(fd, &c, 1), 1);
+        if (++nBytes == 5) done.set_value();
+      },
+      &worker));
+  EXPECT_FALSE(reactor.AddFd(pipeFds[0], EPOLLIN, [](int, uint32_t) {}));
+  EXPECT_EQ(reactor.GetFdCount(), 1u);
+  ASSERT_EQ(write(pipeFds[1], "hello", 5), 5);
+  done.get_future().get();
+  EXPECT_EQ(nBytes, 5);
+  reactor.RemoveFd(pipeFds[0]);
+  EXPECT_EQ(reactor.GetFdCount(), 0u);
+  close(pipeFds[0]);
+  close(pipeFds[1]);
+}
+
+TEST_F(TestReactor, EdgeTriggeredManyFds) {
+  // One reactor thread multiplexes a thousand eventfds
+  std::vector<int> fds(1000);
+  std::atomic<int> nHandled(0);
+  std::promise<void> done;
+  for (int& fd : fds) {
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    ASSERT_TRUE(reactor.AddFd(fd, EPOLLIN | EPOLLET, [&](int readyFd, uint32_t) {
+      EXPECT_EQ(std::this_thread::get_id(), reactor.get_id());
+      uint64_t nValue;
+      while (read(readyFd, &nValue, sizeof(nValue)) > 0) {
+      }
+      if (++nHandled == int(fds.size())) done.set_value();
+    }));
+  }
+  for (int fd : fds) Signal(fd);
+  done.get_future().get();
+  EXPECT_EQ(nHandled, 1000);
+  for (int fd : fds) {
+    reactor.RemoveFd(fd);
+    close(fd);
+  }
+}
+
+TEST_F(TestReactor, Timers) {
+  std::atomic<int> nTicks(0);
+  std::promise<void> ticked;
+  int64_t nTimer = reactor.AddTimer(std::chrono::milliseconds(1), std::chrono::milliseconds(1), [&]() {
+    if (++nTicks == 3) ticked.set_value();
+  });
+  ASSERT_GT(nTimer, 0);
+  ticked.get_future().get();
+  reactor.RemoveTimer(nTimer);
+
+  std::promise<std::thread::id> once;
+  EXPECT_GT(reactor.AddTimer(
+                std::chrono::milliseconds(2), std::chrono::nanoseconds(0),
+                [&]() { once.set_value(std::this_thread::get_id()); }, &worker),
+            0);
+  EXPECT_EQ(once.get_future().get(), worker.get_id());
+}
+
+TEST_F(TestReactor, PushedTasksWakeTheReactor) {
+  std::promise<std::thread::id> ran;
+  reactor.PushFunc([&]() { ran.set_value(std::this_thread::get_id()); });
+  EXPECT_EQ(ran.get_future().get(), reactor.get_id());
+}
+
+TEST_F(TestReactor, RejectedHandlerIsRetried) {
+  // A full thread rejects the handler: the fd is re-armed, and reported until there is room
+  AppMainThread main("main");
+  main.SetCapacity(1, TASK_OVERFLOW_REJECT);
+  Task<void> filler([](Task<void>*) {});
+  main.Push(&filler);
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ASSERT_GE(fd, 0);
+  int nCalls = 0;
+  ASSERT_TRUE(reactor.AddFd(
+      fd, EPOLLIN,
+      [&](int readyFd, uint32_t) {
+        uint64_t nValue;
+        ASSERT_GT(read(readyFd, &nValue, sizeof(nValue)), 0);
+        nCalls++;
+      },
+      &main));
+  auto waitForHandler = [&]() {
+    while (main.GetQueueDepth(TASK_PRIORITY_NORMAL) == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+  Signal(fd);
+  while (main.GetRejectedCount() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  main.Poll();  // runs the filler: now there is room
+  waitForHandler();
+  main.Poll();
+  EXPECT_EQ(nCalls, 1);
+  // Still watched afterwards
+  Signal(fd);
+  waitForHandler();
+  main.Poll();
+  EXPECT_EQ(nCalls, 2);
+  reactor.RemoveFd(fd);
+  close(fd);
+}
+
+TEST(TestReactorLifetime, DestroyedWithPendingHandlers) {
+  // Handlers run by 'main', which only polls once the reactor has pushed them
+  AppMainThread main("main");
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ASSERT_GE(fd, 0);
+  auto pReactor = std::make_unique<Reactor>("reactor");
+  auto destroyReactor = [&]() {
+    TaskThread::SetGlobalQuit(true);
+    pReactor->join();
+    TaskThread::SetGlobalQuit(false);
+    pReactor.reset();
+  };
+  pReactor->Start();
+
+  // A handler destroying the reactor, then re-arming its fd
+  int nCalls = 0;
+  ASSERT_TRUE(pReactor->AddFd(
+      fd, EPOLLIN,
+      [&](int, uint32_t) {
+        nCalls++;
+        destroyReactor();
+      },
+      &main));
+  Signal(fd);
+  while (main.GetQueueDepth(TASK_PRIORITY_NORMAL) == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  main.Poll();
+  EXPECT_EQ(nCalls, 1);
+  EXPECT_FALSE(pReactor);
+
+  // A handler still queued when the reactor goes away is skipped
+  pReactor = std::make_unique<Reactor>("reactor");
+  pReactor->Start();
+  ASSERT_TRUE(pReactor->AddFd(fd, EPOLLIN, [&](int, uint32_t) { nCalls++; }, &main));
+  while (main.GetQueueDepth(TASK_PRIORITY_NORMAL) == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  destroyReactor();
+  main.Poll();
+  EXPECT_EQ(nCalls, 1);
+  close(fd);
+}
+
+TEST(TestReactorFallback, NoEpollFd) {
+  // Out of fds, the reactor still runs pushed tasks, and sleeps rather than spins
+  TaskThread::SetGlobalQuit(false);  // creates the global quit eventfd while fds are plenty
+  int nLowestFreeFd = dup(0);
+  ASSERT_GE(nLowestFreeFd, 0);
+  close(nLowestFreeFd);
+  rlimit limit;
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &limit), 0);
+  rlimit lowered = limit;
+  lowered.rlim_cur = rlim_t(nLowestFreeFd);
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &lowered), 0);
+  auto pReactor = std::make_unique<Reactor>("reactor");
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+
+  pReactor->Start();
+  std::promise<void> ran;
+  pReactor->PushFunc([&]() { ran.set_value(); });
+  ran.get_future().get();
+  EXPECT_FALSE(pReactor->AddFd(0, EPOLLIN, [](int, uint32_t) {}));
+  std::clock_t nCpuBefore = std::clock();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_LT(std::clock() - nCpuBefore, CLOCKS_PER_SEC / 100);
+  TaskThread::SetGlobalQuit(true);
+  pReactor->join();
+  TaskThread::SetGlobalQuit(false);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
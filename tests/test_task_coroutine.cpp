@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <toolbox/task_coroutine.h>
+#include <toolbox/threadpool.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+// Count heap allocations made through operator new
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+class TestTaskCoroutine : public ::testing::Test {
+protected:
+  void SetUp() override {
+    first.Start();
+    second.Start();
+  }
+  void TearDown() override {
+    TaskThread::SetGlobalQuit(true);
+    first.join();
+    second.join();
+    TaskThread::SetGlobalQuit(false);
+  }
+
+  WorkerThread first{"first"};
+  WorkerThread second{"second"};
+};
+
+TEST_F(TestTaskCoroutine, Schedule) {
+  auto hop = [this]() -> CoTask<int> {
+    co_await first.schedule();
+    EXPECT_EQ(TaskThread::GetCurrent(), &first);
+    EXPECT_EQ(std::this_thread::get_id(), first.get_id());
+    co_await second.schedule();
+    EXPECT_EQ(std::this_thread::get_id(), second.get_id());
+    co_return 42;
+  };
+  EXPECT_EQ(CoSyncWait(hop()), 42);
+}
+
+TEST_F(TestTaskCoroutine, ResumesOnAwaitingThread) {
+  // The callee ends on the second thread; the caller continues on the first
+  auto callee = [this](int x) -> CoTask<int> {
+    co_await second.schedule();
+    co_return x * 2;
+  };
+  auto caller = [this, callee]() -> CoTask<int> {
+    co_await first.schedule();
+    int sum = 0;
+    for (int i = 0; i < 10; i++) {
+      sum += co_await callee(i);
+      EXPECT_EQ(std::this_thread::get_id(), first.get_id());
+    }
+    co_return sum;
+  };
+  EXPECT_EQ(CoSyncWait(caller()), 90);
+}
+
+TEST_F(TestTaskCoroutine, Exceptions) {
+  auto thrower = [this]() -> CoTask<void> {
+    co_await second.schedule();
+    throw std::runtime_error("failed");
+  };
+  auto caller = [this, thrower]() -> CoTask<std::string> {
+    co_await first.schedule();
+    try {
+      co_await thrower();
+    } catch (const std::runtime_error& e) {
+      co_return std::string(e.what());
+    }
+    co_return std::string();
+  };
+  EXPECT_EQ(CoSyncWait(caller()), "failed");
+  EXPECT_THROW(CoSyncWait(thrower()), std::runtime_error);
+}
+
+TEST_F(TestTaskCoroutine, SpawnOnPool) {
+  ThreadPool pool("copool", 4);
+  pool.Start();
+  std::atomic<int> count(0);
+  auto work = [&pool, &count]() -> CoTask<void> {
+    co_await pool.schedule();
+    EXPECT_GE(pool.GetWorkerIndex(), 0);
+    count++;
+  };
+  for (int i = 0; i < 100; i++) {
+    CoSpawn(pool, work());
+  }
+  while (count < 100) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  pool.WaitIdle();
+}
+
+TEST(TestTaskCoroutineAlloc, PooledFrames) {
+  // Once warm, a coroutine chain with thread hops makes no heap allocation
+  AppMainThread main("main");
+  int result = 0;
+  auto inner = [&main](int x) -> CoTask<int> {
+    co_await main.schedule();
+    co_return x + 1;
+  };
+  auto outer = [&main, &result, inner]() -> CoTask<void> {
+    for (int i = 0; i < 10; i++) {
+      result = co_await inner(result);
+    }
+  };
+  auto run = [&]() {
+    result = 0;
+    CoSpawn(main, outer());
+    for (int i = 0; i < 100 && result < 10; i++) {
+      main.Poll();
+    }
+  };
+  run();
+  EXPECT_EQ(result, 10);
+  size_t before = allocations;
+  run();
+  EXPECT_EQ(result, 10);
+  EXPECT_EQ(allocations, before);
+}
+
+TEST(TestTaskCoroutineBounded, HopsAreNeverDiscarded) {
+  // Full bounded threads take the hops over capacity: the coroutines neither hang nor leak
+  for (TaskOverflowPolicy nPolicy : {TASK_OVERFLOW_REJECT, TASK_OVERFLOW_DROP_OLDEST}) {
+    AppMainThread home("home");
+    AppMainThread away("away");
+    home.SetCapacity(1, nPolicy);
+    away.SetCapacity(1, nPolicy);
+    Task<void> homeFiller([](Task<void>*) {});
+    Task<void> awayFiller([](Task<void>*) {});
+    home.Push(&homeFiller);
+    away.Push(&awayFiller);
+    int result = 0;
+    auto inner = [&]() -> CoTask<int> {
+      co_await away.schedule();
+      home.Push(&homeFiller);  // full again when the result goes back home
+      co_return 41;
+    };
+    auto outer = [&]() -> CoTask<void> { result = co_await inner() + 1; };
+    CoSpawn(home, outer());
+    for (int i = 0; i < 10 && result == 0; i++) {
+      home.Poll();
+      away.Poll();
+    }
+    EXPECT_EQ(result, 42);
+    EXPECT_EQ(home.GetRejectedCount() + away.GetRejectedCount(), 0u);
+  }
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <toolbox/taskthread.h>
+#include <toolbox/threadpool.h>
+
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TestTaskFuture : public ::testing::Test {
+protected:
+  void SetUp() override {
+    first.Start();
+    second.Start();
+  }
+  void TearDown() override {
+    TaskThread::SetGlobalQuit(true);
+    first.join();
+    second.join();
+    TaskThread::SetGlobalQuit(false);
+  }
+
+  WorkerThread first{"first"};
+  WorkerThread second{"second"};
+};
+
+TEST_F(TestTaskFuture, ThenRunsOnChosenThread) {
+  WaitableTask<int> task([](WaitableTask<int>*) { return 20; });
+  EXPECT_FALSE(task.pFutureState);  // allocated on first use only
+  std::promise<std::string> done;
+  task.Then(second, [this](int x) {
+        EXPECT_EQ(std::this_thread::get_id(), second.get_id());
+        return x + 1;
+      })
+      .Then(first, [this, &done](int x) {
+        EXPECT_EQ(std::this_thread::get_id(), first.get_id());
+        done.set_value(std::to_string(x * 2));
+      });
+  std::future<int> future = task.GetFuture();
+  first.Push(&task);
+  EXPECT_EQ(done.get_future().get(), "42");
+  EXPECT_EQ(future.get(), 20);
+  EXPECT_TRUE(task.GetTaskFuture().IsReady());
+
+  // Too late: the result went to the std::future only
+  WaitableTask<int> late([](WaitableTask<int>*) { return 1; });
+  late.Execute();
+  TaskFuture<int> lateFuture = late.GetTaskFuture();
+  ASSERT_TRUE(lateFuture.IsReady());
+  EXPECT_THROW(lateFuture.GetValue(), std::logic_error);
+}
+
+TEST_F(TestTaskFuture, ThenAfterCompletion) {
+  // A continuation attached to a ready future is pushed right away
+  TaskFuture<int> future;
+  future.SetValue(5);
+  std::promise<int> done;
+  future.Then(first, [&done](int x) { done.set_value(x); });
+  EXPECT_EQ(done.get_future().get(), 5);
+
+  TaskFuture<void> ready;
+  ready.SetValue({});
+  std::promise<void> doneVoid;
+  ready.Then(second, [&doneVoid]() { doneVoid.set_value(); });
+  doneVoid.get_future().get();
+}
+
+TEST_F(TestTaskFuture, ExceptionsSkipContinuations) {
+  WaitableTask<int> task([](WaitableTask<int>*) -> int { throw std::runtime_error("failed"); });
+  bool bRan = false;
+  TaskFuture<int> end = task.Then(first, [&bRan](int x) {
+    bRan = true;
+    return x;
+  });
+  std::promise<void> done;
+  end.OnReady([&done]() { done.set_value(); });
+  std::future<int> future = task.GetFuture();
+  second.Push(&task);
+  done.get_future().get();
+  EXPECT_FALSE(bRan);
+  EXPECT_THROW(end.GetValue(), std::runtime_error);
+  EXPECT_THROW(future.get(), std::runtime_error);
+
+  // Exceptions thrown by a continuation are caught too
+  TaskFuture<int> source;
+  TaskFuture<int> thrown = source.Then(first, [](int) -> int { throw std::logic_error("bad"); });
+  std::promise<void> thrownDone;
+  thrown.OnReady([&thrownDone]() { thrownDone.set_value(); });
+  source.SetValue(1);
+  thrownDone.get_future().get();
+  EXPECT_THROW(thrown.GetValue(), std::logic_error);
+}
+
+TEST_F(TestTaskFuture, WhenAll) {
+  ThreadPool pool("pool", 4);
+  pool.Start();
+  std::vector<TaskFuture<int>> futures;
+  for (int i = 0; i < 16; i++) {
+    TaskFuture<int> future;
+    pool.PushFunc([future, i]() { future.SetValue(i * i); });
+    futures.push_back(future);
+  }
+  std::promise<int> sum;
+  WhenAll(futures).Then(first, [this, &sum](const std::vector<int>& values) {
+    EXPECT_EQ(std::this_thread::get_id(), first.get_id());
+    int total = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+      EXPECT_EQ(values[i], int(i * i));
+      total += values[i];
+    }
+    sum.set_value(total);
+  });
+  EXPECT_EQ(sum.get_future().get(), 1240);
+
+  // Different types
+  TaskFuture<int> number;
+  TaskFuture<std::string> text;
+  TaskFuture<void> signal;
+  std::promise<std::string> joined;
+  typedef std::tuple<int, std::string, std::monostate> RESULTS;
+  WhenAll(number, text, signal).Then(second, [&joined](const RESULTS& values) {
+    joined.set_value(std::get<1>(values) + std::to_string(std::get<0>(values)));
+  });
+  pool.PushFunc([text]() { text.SetValue("answer "); });
+  pool.PushFunc([signal]() { signal.SetValue({}); });
+  pool.PushFunc([number]() { number.SetValue(42); });
+  EXPECT_EQ(joined.get_future().get(), "answer 42");
+
+  EXPECT_TRUE(WhenAll(std::vector<TaskFuture<int>>()).IsReady());
+
+  // Values with no default constructor
+  struct Id {
+    explicit Id(int n) : n(n) {}
+    int n;
+  };
+  std::vector<TaskFuture<Id>> ids(2);
+  auto allIds = WhenAll(ids);
+  ids[1].SetValue(Id(2));
+  ids[0].SetValue(Id(1));
+  ASSERT_TRUE(allIds.IsReady());
+  EXPECT_EQ(allIds.GetValue()[0].n, 1);
+  EXPECT_EQ(allIds.GetValue()[1].n, 2);
+  pool.Stop();
+}
+
+TEST_F(TestTaskFuture, WhenAny) {
+  std::vector<TaskFuture<std::string>> futures(3);
+  std::promise<std::pair<size_t, std::string>> winnerPromise;
+  WhenAny(futures).Then(first, [&winnerPromise](const std::pair<size_t, std::string>& winner) {
+    winnerPromise.set_value(winner);
+  });
+  second.PushFunc([futures]() {
+    futures[1].SetValue("b");
+    futures[0].SetValue("a");
+  });
+  auto winner = winnerPromise.get_future().get();
+  EXPECT_EQ(winner.first, 1u);
+  EXPECT_EQ(winner.second, "b");
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <toolbox/task_graph.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(TestTaskGraph, Dependencies) {
+  ThreadPool pool("graph", 4);
+  pool.Start();
+  std::mutex mutex;
+  std::string order;
+  auto add = [&](char c) {
+    return [&, c]() {
+      std::lock_guard lock(mutex);
+      order += c;
+    };
+  };
+  TaskGraph graph;
+  auto a = graph.AddNode("a", add('a'));
+  auto b = graph.AddNode("b", add('b'));
+  auto c = graph.AddNode("c", add('c'));
+  auto d = graph.AddNode("d", add('d'));
+  graph.AddDependency(a, b);
+  graph.AddDependency(a, c);
+  graph.AddDependency(b, d);
+  graph.AddDependency(c, d);
+  EXPECT_EQ(graph.GetNodeCount(), 4u);
+
+  // Built once, run many times
+  for (int i = 0; i < 100; i++) {
+    order.clear();
+    ASSERT_TRUE(graph.Run(pool));
+    ASSERT_EQ(order.size(), 4u);
+    EXPECT_EQ(order.front(), 'a');
+    EXPECT_EQ(order.back(), 'd');
+  }
+}
+
+TEST(TestTaskGraph, WideGraph) {
+  // Many independent nodes feeding one: every node runs exactly once per run
+  TaskGraph graph;
+  std::vector<std::atomic<int>> runs(200);
+  std::atomic<int> nSeenBySink(0);
+  auto sink = graph.AddNode("sink", [&]() {
+    for (auto& r : runs) nSeenBySink += r.load();
+  });
+  for (size_t i = 0; i < runs.size(); i++) {
+    auto node = graph.AddNode("leaf", [&runs, i]() { runs[i]++; });
+    graph.AddDependency(node, sink);
+  }
+  for (int i = 1; i <= 10; i++) {
+    ASSERT_TRUE(graph.Run());
+    EXPECT_EQ(nSeenBySink, 200 * i * (i + 1) / 2);
+  }
+}
+
+TEST(TestTaskGraph, Cycle) {
+  TaskGraph graph;
+  bool bRan = false;
+  auto a = graph.AddNode("a", [&]() { bRan = true; });
+  auto b = graph.AddNode("b", [&]() { bRan = true; });
+  auto c = graph.AddNode("c", [&]() { bRan = true; });
+  graph.AddDependency(a, b);
+  graph.AddDependency(b, c);
+  graph.AddDependency(c, b);
+  EXPECT_FALSE(graph.Run());
+  EXPECT_FALSE(bRan);
+  EXPECT_TRUE(graph.GetReport().nodes.empty());
+}
+
+TEST(TestTaskGraph, CriticalPath) {
+  ThreadPool pool("graph", 2);
+  pool.Start();
+  auto sleepMs = [](int ms) {
+    return [ms]() { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); };
+  };
+  TaskGraph graph;
+  auto start = graph.AddNode("start", sleepMs(1));
+  auto fast = graph.AddNode("fast", sleepMs(1));
+  auto slow = graph.AddNode("slow", sleepMs(20));
+  auto end = graph.AddNode("end", sleepMs(1));
+  graph.AddDependency(start, fast);
+  graph.AddDependency(start, slow);
+  graph.AddDependency(fast, end);
+  graph.AddDependency(slow, end);
+  ASSERT_TRUE(graph.Run(pool));
+
+  TaskGraphReport report = graph.GetReport();
+  ASSERT_EQ(report.nodes.size(), 4u);
+  EXPECT_EQ(report.criticalPath, (std::vector<size_t>{start, slow, end}));
+  EXPECT_TRUE(report.nodes[slow].bCritical);
+  EXPECT_FALSE(report.nodes[fast].bCritical);
+  EXPECT_GE(report.nCriticalPathNs, 22000000);
+  EXPECT_GE(report.nWallNs, report.nCriticalPathNs);
+  EXPECT_GE(report.nodes[end].nStartNs, report.nodes[slow].nStartNs + report.nodes[slow].nDurationNs);
+  std::string strReport = report.ToString();
+  EXPECT_NE(strReport.find("slow"), std::string::npos);
+  EXPECT_EQ(strReport.find("fast"), std::string::npos);
+}
+
+TEST(TestTaskGraph, Exception) {
+  ThreadPool pool("graph", 2);
+  pool.Start();
+  TaskGraph graph;
+  bool bRan = false;
+  auto a = graph.AddNode("a", []() { throw std::runtime_error("node failed"); });
+  auto b = graph.AddNode("b", [&]() { bRan = true; });
+  graph.AddDependency(a, b);
+  EXPECT_THROW(graph.Run(pool), std::runtime_error);
+  EXPECT_FALSE(bRan);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include <toolbox/inline_function.h>
+#include <toolbox/task_pool.h>
+#include <toolbox/taskthread.h>
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Count heap allocations made through operator new
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+struct Counted {
+  static int alive;
+  Counted() { alive++; }
+  Counted(const Counted&) { alive++; }
+  Counted(Counted&&) noexcept { alive++; }
+  ~Counted() { alive--; }
+};
+int Counted::alive = 0;
+
+TEST(TestInlineFunction, MoveOnlyCapture) {
+  auto ptr = std::make_unique<int>(41);
+  InlineFunction<int(int)> f([p = std::move(ptr)](int x) { return *p + x; });
+  EXPECT_TRUE(f);
+  EXPECT_EQ(f(1), 42);
+  InlineFunction<int(int)> g(std::move(f));
+  EXPECT_FALSE(f);
+  EXPECT_EQ(g(2), 43);
+  g = nullptr;
+  EXPECT_FALSE(g);
+}
+
+TEST(TestInlineFunction, InlineAndHeapStorage) {
+  std::array<char, 16> small{};
+  std::array<char, 200> large{};
+  auto fsmall = [small]() { return small.size(); };
+  auto flarge = [large]() { return large.size(); };
+  static_assert(InlineFunction<size_t()>::storedInline<decltype(fsmall)>());
+  static_assert(!InlineFunction<size_t()>::storedInline<decltype(flarge)>());
+
+  size_t before = allocations;
+  InlineFunction<size_t()> a(fsmall);
+  EXPECT_EQ(allocations, before);
+  InlineFunction<size_t()> b(flarge);
+  EXPECT_EQ(allocations, before + 1);
+  EXPECT_EQ(a(), 16);
+  EXPECT_EQ(b(), 200);
+  std::swap(a, b);
+  EXPECT_EQ(a(), 200);
+  EXPECT_EQ(b(), 16);
+}
+
+TEST(TestInlineFunction, DestroysCallable) {
+  {
+    InlineFunction<void()> f([c = Counted()]() {});
+    EXPECT_EQ(Counted::alive, 1);
+    InlineFunction<void()> g(std::move(f));
+    EXPECT_EQ(Counted::alive, 1);
+    g.reset();
+    EXPECT_EQ(Counted::alive, 0);
+    InlineFunction<void(), 8> h([c = Counted(), pad = std::array<char, 64>()]() {});
+    EXPECT_EQ(Counted::alive, 1);
+  }
+  EXPECT_EQ(Counted::alive, 0);
+}
+
+TEST(TestTaskPool, RecyclesBlocks) {
+  void* a = TaskPool::Allocate(40);
+  void* b = TaskPool::Allocate(100);
+  TaskPool::Free(a);
+  void* c = TaskPool::Allocate(30);  // same size class, reused
+  EXPECT_EQ(c, a);
+  TaskPool::Free(c);
+  TaskPool::Free(b);
+  void* big = TaskPool::Allocate(TaskPool::kMaxBlockSize);
+  TaskPool::Free(big);
+  TaskPool::Free(nullptr);
+}
+
+TEST(TestTaskPool, CrossThreadAndThreadExit) {
+  const int64_t base = TaskPool::GetLiveBlockCount();
+  std::vector<void*> blocks;
+  std::thread owner([&blocks]() {
+    for (int i = 0; i < 100; i++) {
+      blocks.push_back(TaskPool::Allocate(64));
+    }
+    // Half returned before the owner exits, half after
+    for (int i = 0; i < 50; i++) {
+      TaskPool::Free(blocks.back());
+      blocks.pop_back();
+    }
+  });
+  owner.join();
+  EXPECT_EQ(TaskPool::GetLiveBlockCount(), base + 50);
+  for (void* p : blocks) {
+    TaskPool::Free(p);
+  }
+  EXPECT_EQ(TaskPool::GetLiveBlockCount(), base);
+}
+
+TEST(TestTaskPool, PushFuncDoesNotAllocate) {
+  // Once the pool is warm, pushing a typical lambda to a TaskThread allocates nothing
+  AppMainThread thread("main");
+  int count = 0;
+  double a = 1.0, b = 2.0;
+  auto push = [&](int n) {
+    for (int i = 0; i < n; i++) {
+      thread.PushFunc([&count, a, b, i]() { count += int(a + b) + i - i; });
+    }
+    thread.Poll();
+  };
+  push(100);
+  size_t before = allocations;
+  push(100);
+  EXPECT_EQ(allocations, before);
+  EXPECT_EQ(count, 600);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
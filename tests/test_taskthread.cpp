@@ -0,0 +1,540 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <toolbox/taskthread.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stops the thread loops at the end of a test, and re-arms them for the next one
+static void QuitAndJoin(std::vector<TaskThread*> threads) {
+  TaskThread::SetGlobalQuit(true);
+  for (auto* t : threads) {
+    t->join();
+  }
+  TaskThread::SetGlobalQuit(false);
+}
+
+TEST(TestTaskThread, ManyProducers) {
+  // Tasks from one producer run in push order; nothing is lost between producers
+  constexpr int kProducers = 4;
+  constexpr int kTasks = 20000;
+  WorkerThread worker("consumer");
+  worker.Start();
+  std::vector<int> last(kProducers, -1);
+  std::atomic<int> count(0);
+  std::atomic<bool> ordered(true);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; p++) {
+    producers.emplace_back([&, p]() {
+      for (int i = 0; i < kTasks; i++) {
+        worker.PushFunc([&, p, i](Task<void>* pTask) {
+          if (last[size_t(p)] != i - 1) ordered = false;
+          last[size_t(p)] = i;
+          count++;
+          delete pTask;
+        });
+      }
+    });
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  while (count < kProducers * kTasks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(ordered);
+  QuitAndJoin({&worker});
+}
+
+TEST(TestTaskThread, WakesSleepingConsumer) {
+  // An idle worker sleeps with no timeout: only the push can wake it up (the pause gives it time to
+  // fall asleep, the test does not depend on it)
+  WorkerThread worker("sleeper");
+  worker.Start();
+  for (int i = 0; i < 20; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::promise<void> done;
+    worker.PushFunc([&done]() { done.set_value(); });
+    done.get_future().wait();
+  }
+  QuitAndJoin({&worker});
+}
+
+TEST(TestTaskThread, QuitWakesIdleWorkers) {
+  // Asleep with no timeout, the workers only exit if the global quit wakes them up
+  std::vector<WorkerThread> workers(8);
+  for (auto& w : workers) {
+    w.Start();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  std::vector<TaskThread*> threads;
+  for (auto& w : workers) {
+    threads.push_back(&w);
+  }
+  QuitAndJoin(threads);
+}
+
+TEST(TestTaskThread, WatchFd) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  WorkerThread worker("fdwatcher");
+  std::atomic<int> received(0);
+  std::atomic<bool> onWorker(false);
+  worker.WatchFd(fds[0], POLLIN, [&](int fd, short revents) {
+    char c;
+    if ((revents & POLLIN) && read(fd, &c, 1) == 1) received += c;
+    onWorker = std::this_thread::get_id() == worker.get_id();
+  });
+  worker.Start();
+  char one = 1;
+  for (int i = 0; i < 5; i++) {
+    ASSERT_EQ(write(fds[1], &one, 1), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  while (received < 5) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(onWorker);
+  // Tasks still run while fds are watched; unwatching from a task stops the callbacks
+  std::promise<void> unwatched;
+  worker.PushFunc([&]() {
+    worker.UnwatchFd(fds[0]);
+    unwatched.set_value();
+  });
+  unwatched.get_future().wait();
+  ASSERT_EQ(write(fds[1], &one, 1), 1);
+  // A watched fd would be reported by the same poll() as this push
+  std::promise<void> polled;
+  worker.PushFunc([&]() { polled.set_value(); });
+  polled.get_future().wait();
+  EXPECT_EQ(received, 5);
+  QuitAndJoin({&worker});
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(TestTaskThread, Poll) {
+  // Without a thread of its own, tasks run when the owner calls Poll()
+  AppMainThread main("main");
+  int count = 0;
+  Task<void> task([&count](Task<void>*) { count++; });
+  main.Push(&task);
+  EXPECT_EQ(count, 0);
+  main.Poll();
+  EXPECT_EQ(count, 1);
+  // The same task can be pushed again once it was popped
+  main.Push(&task);
+  main.Push(new Task<void>([&count](Task<void>* pTask) {
+    count += 10;
+    delete pTask;
+  }));
+  main.Poll();
+  EXPECT_EQ(count, 12);
+}
+
+TEST(TestTaskThread, BatchLimits) {
+  AppMainThread main("main");
+  int count = 0;
+  for (int i = 0; i < 100; i++) {
+    main.PushFunc([&count]() { count++; });
+  }
+  main.SetBatchLimits(30);
+  main.Poll();
+  EXPECT_EQ(count, 30);
+  main.Poll();
+  EXPECT_EQ(count, 60);
+
+  // Leftovers run first; tasks pushed by the batch itself run in the next Poll()
+  std::vector<int> order;
+  main.PushFunc([&]() {
+    order.push_back(1);
+    main.PushFunc([&]() { order.push_back(2); });
+  });
+  main.SetBatchLimits(0);
+  main.Poll();
+  EXPECT_EQ(count, 100);
+  EXPECT_EQ(order, std::vector<int>({1}));
+  main.Poll();
+  EXPECT_EQ(order, std::vector<int>({1, 2}));
+
+  // Time budget: the first task alone outlasts a 5ms budget, which stops the batch right after it
+  main.PushFunc([&count]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(6));
+    count++;
+  });
+  for (int i = 0; i < 9; i++) {
+    main.PushFunc([&count]() { count++; });
+  }
+  main.SetBatchLimits(0, std::chrono::milliseconds(5));
+  main.Poll();
+  EXPECT_EQ(count, 101);
+  main.SetBatchLimits(0);
+  main.Poll();
+  EXPECT_EQ(count, 110);
+}
+
+TEST(TestTaskThread, Priorities) {
+  AppMainThread main("main");
+  std::string order;
+  main.PushFunc([&]() { order += 'n'; });
+  main.PushFunc([&]() { order += 'l'; }, TASK_PRIORITY_LOW);
+  main.PushFunc([&]() { order += 'h'; }, TASK_PRIORITY_HIGH);
+  main.PushFunc([&]() { order += 'N'; }, TASK_PRIORITY_NORMAL);
+  main.PushFunc([&]() { order += 'c'; }, TASK_PRIORITY_CRITICAL);
+  main.PushFunc([&]() { order += 'H'; }, TASK_PRIORITY_HIGH);
+  EXPECT_EQ(main.GetQueueDepth(TASK_PRIORITY_HIGH), 2);
+  EXPECT_EQ(main.GetQueueDepth(TASK_PRIORITY_NORMAL), 2);
+  EXPECT_EQ(main.GetQueueDepth(TASK_PRIORITY_LOW), 1);
+  main.Poll();
+  EXPECT_EQ(order, "chHnNl");
+  EXPECT_EQ(main.GetQueueDepth(TASK_PRIORITY_HIGH), 0);
+
+  // A task pushed during the batch is sorted in right away, but the batch does not grow
+  order.clear();
+  main.PushFunc([&]() {
+    order += 'n';
+    main.PushFunc([&]() { order += 'c'; }, TASK_PRIORITY_CRITICAL);
+  });
+  main.PushFunc([&]() { order += 'N'; });
+  main.Poll();
+  EXPECT_EQ(order, "nc");
+  main.Poll();
+  EXPECT_EQ(order, "ncN");
+}
+
+TEST(TestTaskThread, Deadlines) {
+  AppMainThread main("main");
+  auto now = std::chrono::steady_clock::now();
+  std::string order;
+  main.PushFunc([&]() { order += 'c'; }, TASK_PRIORITY_CRITICAL);
+  main.PushFuncWithDeadline([&]() { order += '3'; }, now + std::chrono::seconds(3));
+  main.PushFuncWithDeadline([&]() { order += '1'; }, now + std::chrono::seconds(1));
+  main.PushFuncWithDeadline([&]() { order += '0'; }, now - std::chrono::seconds(1));
+  main.PushFuncWithDeadline([&]() { order += '2'; }, now + std::chrono::seconds(2));
+  EXPECT_EQ(main.GetDeadlineQueueDepth(), 4);
+  main.Poll();
+  // A deadline does not jump ahead of higher classes
+  EXPECT_EQ(order, "c0123");
+  EXPECT_EQ(main.GetDeadlineQueueDepth(), 0);
+  EXPECT_EQ(main.GetDeadlineMissCount(), 1);
+
+  // Within a class, deadline tasks go first
+  order.clear();
+  main.PushFunc([&]() { order += 'n'; });
+  main.PushFuncWithDeadline([&]() { order += 'l'; }, now, TASK_PRIORITY_LOW);
+  main.PushFuncWithDeadline([&]() { order += 'd'; }, now + std::chrono::seconds(1), TASK_PRIORITY_NORMAL);
+  main.Poll();
+  EXPECT_EQ(order, "dnl");
+
+  // A steady flow of deadline tasks does not starve lower classes. Aging is only enabled once the
+  // first task has run, so a slow Poll() cannot age 'n' early.
+  main.SetAging(std::chrono::nanoseconds(0));
+  main.SetBatchLimits(1);
+  order.clear();
+  main.PushFunc([&]() { order += 'n'; });
+  main.PushFuncWithDeadline([&]() { order += 'd'; }, now);
+  main.Poll();
+  main.SetAging(std::chrono::milliseconds(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(3));
+  main.PushFuncWithDeadline([&]() { order += 'D'; }, now);
+  main.SetBatchLimits(0);
+  main.Poll();
+  EXPECT_EQ(order, "dnD");
+}
+
+TEST(TestTaskThread, Aging) {
+  AppMainThread main("main");
+  // Aging is only enabled once the first task has run, so a slow Poll() cannot age 'l' early
+  main.SetAging(std::chrono::nanoseconds(0));
+  std::string order;
+  main.PushFunc([&]() { order += 'l'; }, TASK_PRIORITY_LOW);
+  main.PushFunc([&]() { order += 'h'; }, TASK_PRIORITY_HIGH);
+  main.SetBatchLimits(1);
+  main.Poll();
+  EXPECT_EQ(order, "h");
+  // The low priority task has now waited past the aging limit
+  main.SetAging(std::chrono::milliseconds(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(3));
+  main.PushFunc([&]() { order += 'H'; }, TASK_PRIORITY_HIGH);
+  main.SetBatchLimits(0);
+  main.Poll();
+  EXPECT_EQ(order, "hlH");
+
+  // Without aging, priority wins
+  main.SetAging(std::chrono::nanoseconds(0));
+  order.clear();
+  main.PushFunc([&]() { order += 'l'; }, TASK_PRIORITY_LOW);
+  main.PushFunc([&]() { order += 'h'; }, TASK_PRIORITY_HIGH);
+  main.SetBatchLimits(1);
+  main.Poll();
+  std::this_thread::sleep_for(std::chrono::milliseconds(3));
+  main.PushFunc([&]() { order += 'H'; }, TASK_PRIORITY_HIGH);
+  main.SetBatchLimits(0);
+  main.Poll();
+  EXPECT_EQ(order, "hHl");
+
+  // Waiting before the consumer takes the task counts
+  main.SetAging(std::chrono::milliseconds(1));
+  order.clear();
+  main.PushFunc([&]() { order += 'l'; }, TASK_PRIORITY_LOW);
+  std::this_thread::sleep_for(std::chrono::milliseconds(3));
+  main.PushFunc([&]() { order += 'h'; }, TASK_PRIORITY_HIGH);
+  main.Poll();
+  EXPECT_EQ(order, "lh");
+}
+
+TEST(TestTaskThread, Stats) {
+  AppMainThread main("main");
+  main.PushFunc([]() {});  // pushed while disabled: not counted
+  main.Poll();
+  EXPECT_EQ(main.GetStats().nTasks, 0u);
+
+  main.EnableStats();
+  EXPECT_TRUE(main.IsStatsEnabled());
+  for (int i = 0; i < 3; i++) {
+    main.PushFunc([]() { std::this_thread::sleep_for(std::chrono::milliseconds(2)); });
+  }
+  const int nSlowLine = __LINE__ - 2;
+  struct NamedTask : public AbstractTask {
+    void Execute() override {}
+  } named;
+  named.szName = "named";
+  main.Push(&named);
+  EXPECT_EQ(main.GetStats().nQueueDepth, 4);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  main.Poll();
+
+  TaskThreadStats stats = main.GetStats();
+  EXPECT_EQ(stats.nTasks, 4u);
+  EXPECT_EQ(stats.nQueueDepth, 0);
+  EXPECT_EQ(stats.nMaxQueueDepth, 4);
+  EXPECT_GT(stats.dTasksPerSecond, 0.0);
+  EXPECT_EQ(stats.runTime.count(), 4u);
+  EXPECT_GE(stats.runTime.max(), 2000000u);
+  EXPECT_EQ(stats.queueWait.count(), 4u);
+  EXPECT_GE(stats.queueWait.min(), 1000000u);
+  // The named task waited for the three slow ones
+  ASSERT_EQ(stats.tags.size(), 2u);
+  EXPECT_EQ(stats.tags[0].strTag, std::string(__FILE__) + ":" + std::to_string(nSlowLine));
+  EXPECT_EQ(stats.tags[0].nCount, 3u);
+  EXPECT_GE(stats.tags[0].nMaxRunNs, 2000000u);
+  EXPECT_EQ(stats.tags[1].strTag, "named");
+  EXPECT_GE(stats.tags[1].nWaitNs, 6000000u);
+
+  main.EnableStats(false);
+  main.PushFunc([]() {});
+  main.Poll();
+  EXPECT_EQ(main.GetStats().nTasks, 4u);
+}
+
+TEST(TestTaskThread, ThreadOptions) {
+  cpu_set_t allowed;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  int nCpu = 0;
+  while (!CPU_ISSET(nCpu, &allowed)) nCpu++;
+
+  WorkerThread worker("options");
+  ThreadOptions options;
+  options.cpus = {nCpu};
+  options.nNice = 5;
+  options.nStackSize = 4 << 20;
+  worker.SetThreadOptions(options);
+  worker.Start();
+
+  std::promise<void> done;
+  worker.PushFunc([&]() {
+    cpu_set_t set;
+    EXPECT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(set), &set), 0);
+    EXPECT_EQ(CPU_COUNT(&set), 1);
+    EXPECT_TRUE(CPU_ISSET(nCpu, &set));
+    EXPECT_EQ(getpriority(PRIO_PROCESS, id_t(gettid())), 5);
+    pthread_attr_t attr;
+    size_t nStackSize = 0;
+    EXPECT_EQ(pthread_getattr_np(pthread_self(), &attr), 0);
+    pthread_attr_getstacksize(&attr, &nStackSize);
+    pthread_attr_destroy(&attr);
+    EXPECT_GE(nStackSize, size_t(4 << 20));
+    done.set_value();
+  });
+  done.get_future().get();
+  TaskThread::SetGlobalQuit();
+  worker.join();
+  TaskThread::SetGlobalQuit(false);
+
+  // Real-time scheduling falls back to normal scheduling when not permitted
+  options = ThreadOptions();
+  options.nSchedPolicy = SCHED_FIFO;
+  options.nSchedPriority = 10;
+  bool bApplied = false;
+  int nPolicy = -1;
+  std::thread t([&]() {
+    bApplied = ApplyThreadOptions(options, "fifo");
+    sched_param param;
+    pthread_getschedparam(pthread_self(), &nPolicy, &param);
+  });
+  t.join();
+  EXPECT_EQ(nPolicy, bApplied ? SCHED_FIFO : SCHED_OTHER);
+}
+
+// Counts the times it is discarded instead of executed
+struct CountedTask : public AbstractTask {
+  void Execute() override { nExecuted++; }
+  void Discard() override { nDiscarded++; }
+  int nExecuted = 0;
+  int nDiscarded = 0;
+};
+
+TEST(TestTaskThread, BoundedReject) {
+  AppMainThread main("main");
+  main.SetCapacity(3, TASK_OVERFLOW_REJECT);
+  EXPECT_EQ(main.GetCapacity(), 3u);
+  std::vector<CountedTask> tasks(5);
+  for (auto& task : tasks) main.Push(&task);
+  EXPECT_EQ(main.GetQueueSize(), 3u);
+  EXPECT_EQ(main.GetRejectedCount(), 2u);
+  EXPECT_EQ(main.GetHighWaterMark(), 3u);
+  CountedTask extra;
+  EXPECT_FALSE(main.TryPush(&extra));
+  EXPECT_EQ(extra.nDiscarded, 0);  // still ours
+  // Rejected lambdas are freed
+  main.PushFunc([]() { FAIL(); });
+  EXPECT_EQ(main.GetRejectedCount(), 3u);
+  CountedTask urgent;
+  main.PushWithDeadline(&urgent, std::chrono::steady_clock::now(), TASK_PRIORITY_CRITICAL);
+  EXPECT_EQ(main.GetRejectedCount(), 4u);
+
+  main.Poll();
+  EXPECT_EQ(main.GetQueueSize(), 0u);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    EXPECT_EQ(tasks[i].nExecuted, i < 3 ? 1 : 0);
+    EXPECT_EQ(tasks[i].nDiscarded, i < 3 ? 0 : 1);
+  }
+  EXPECT_TRUE(main.TryPush(&extra));
+  main.Poll();
+  EXPECT_EQ(extra.nExecuted, 1);
+  // Pushed again as a normal task
+  main.Push(&urgent);
+  EXPECT_EQ(main.GetQueueDepth(TASK_PRIORITY_NORMAL), 1);
+  EXPECT_EQ(main.GetDeadlineQueueDepth(), 0);
+  main.Poll();
+  EXPECT_EQ(urgent.nExecuted, 1);
+}
+
+TEST(TestTaskThread, UnboundedQueueSize) {
+  // Unbounded pushes are not counted, unless statistics are enabled
+  AppMainThread main("main");
+  CountedTask first;
+  main.Push(&first);
+  EXPECT_EQ(main.GetQueueSize(), 0u);
+  main.EnableStats();
+  CountedTask second;
+  main.Push(&second);
+  EXPECT_EQ(main.GetQueueSize(), 1u);
+  // Bounding the queue later does not count the tasks already queued
+  main.EnableStats(false);
+  main.SetCapacity(1, TASK_OVERFLOW_REJECT);
+  CountedTask third;
+  EXPECT_FALSE(main.TryPush(&third));
+  main.Poll();
+  EXPECT_EQ(main.GetQueueSize(), 0u);
+  EXPECT_EQ(first.nExecuted + second.nExecuted, 2);
+  EXPECT_TRUE(main.TryPush(&third));
+  EXPECT_EQ(main.GetQueueSize(), 1u);
+  main.Poll();
+  EXPECT_EQ(main.GetQueueSize(), 0u);
+}
+
+TEST(TestTaskThread, BoundedDropOldest) {
+  AppMainThread main("main");
+  main.SetCapacity(3, TASK_OVERFLOW_DROP_OLDEST);
+  std::string order;
+  for (char c : std::string("abcde")) main.PushFunc([&order, c]() { order += c; });
+  main.Poll();
+  EXPECT_EQ(order, "cde");
+  EXPECT_EQ(main.GetDroppedCount(), 2u);
+  EXPECT_EQ(main.GetRejectedCount(), 0u);
+  EXPECT_EQ(main.GetQueueSize(), 0u);
+
+  // The oldest push goes, whatever its class
+  order.clear();
+  main.PushFunc([&]() { order += 'h'; }, TASK_PRIORITY_HIGH);
+  main.PushFunc([&]() { order += 'l'; }, TASK_PRIORITY_LOW);
+  main.PushFunc([&]() { order += 'n'; });
+  main.PushFunc([&]() { order += 'c'; }, TASK_PRIORITY_CRITICAL);
+  main.Poll();
+  EXPECT_EQ(order, "cnl");
+  EXPECT_EQ(main.GetDroppedCount(), 3u);
+}
+
+TEST(TestTaskThread, BoundedDropOldestBusyConsumer) {
+  WorkerThread worker("worker");
+  worker.SetCapacity(4, TASK_OVERFLOW_DROP_OLDEST);
+  worker.Start();
+  std::promise<void> started;
+  std::promise<void> release;
+  worker.PushFunc([&]() {
+    started.set_value();
+    release.get_future().wait();
+  });
+  started.get_future().wait();
+
+  // The worker cannot drop anything while it is stuck: the producers bound the queue themselves
+  std::atomic<int> nExecuted(0);
+  std::vector<std::thread> producers;
+  for (int i = 0; i < 4; i++) {
+    producers.emplace_back([&]() {
+      for (int j = 0; j < 1000; j++) worker.PushFunc([&]() { nExecuted++; });
+    });
+  }
+  for (auto& producer : producers) producer.join();
+  EXPECT_LE(worker.GetQueueSize(), 8u);
+  EXPECT_LE(worker.GetHighWaterMark(), 8u);
+  EXPECT_EQ(worker.GetDroppedCount(), 3992u);
+
+  // Then it keeps the newest 4
+  release.set_value();
+  while (nExecuted < 4) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  // Everything pushed before it has run or been dropped once this one runs
+  std::promise<void> drained;
+  worker.PushFunc([&]() { drained.set_value(); });
+  drained.get_future().wait();
+  EXPECT_EQ(nExecuted, 4);
+  EXPECT_EQ(worker.GetDroppedCount(), 3996u);
+  QuitAndJoin({&worker});
+}
+
+TEST(TestTaskThread, BoundedBlock) {
+  WorkerThread worker("worker");
+  worker.SetCapacity(2, TASK_OVERFLOW_BLOCK);
+  worker.Start();
+  std::atomic<int> nExecuted(0);
+  std::atomic<bool> bSelfPushed(false);
+  for (int i = 0; i < 50; i++) {
+    worker.PushFunc([&]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      nExecuted++;
+    });
+  }
+  // Pushing to a full queue from the thread itself does not deadlock
+  worker.PushFunc([&]() {
+    for (int i = 0; i < 5; i++) worker.PushFunc([&]() { nExecuted++; });
+    bSelfPushed = true;
+  });
+  while (nExecuted < 55) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_TRUE(bSelfPushed);
+  EXPECT_EQ(worker.GetRejectedCount(), 0u);
+  EXPECT_LE(worker.GetHighWaterMark(), 6u);
+  TaskThread::SetGlobalQuit();
+  worker.join();
+  TaskThread::SetGlobalQuit(false);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <toolbox/taskthread.h>
+#include <toolbox/threadpool.h>
+#include <toolbox/work_stealing_deque.h>
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+TEST(TestWorkStealingDeque, OwnerIsLifoThiefIsFifo) {
+  WorkStealingDeque<intptr_t> deque(2);
+  for (intptr_t i = 1; i <= 10; i++) {
+    deque.push(i);  // grows past the initial capacity
+  }
+  EXPECT_EQ(deque.size(), 10);
+  intptr_t v = 0;
+  ASSERT_TRUE(deque.pop(v));
+  EXPECT_EQ(v, 10);
+  ASSERT_TRUE(deque.steal(v));
+  EXPECT_EQ(v, 1);
+  while (deque.pop(v)) {
+  }
+  EXPECT_TRUE(deque.empty());
+  EXPECT_FALSE(deque.steal(v));
+}
+
+TEST(TestWorkStealingDeque, ConcurrentSteal) {
+  // Every item is taken exactly once, by the owner or by one of the thieves
+  constexpr intptr_t kItems = 200000;
+  WorkStealingDeque<intptr_t> deque(16);
+  std::vector<std::atomic<int>> taken(kItems);
+  std::atomic_bool done(false);
+  std::vector<std::thread> thieves;
+  for (int t = 0; t < 3; t++) {
+    thieves.emplace_back([&]() {
+      intptr_t v;
+      while (!done || !deque.empty()) {
+        if (deque.steal(v)) taken[size_t(v)]++;
+      }
+    });
+  }
+  intptr_t v;
+  for (intptr_t i = 0; i < kItems; i++) {
+    deque.push(i);
+    if (i % 3 == 0 && deque.pop(v)) taken[size_t(v)]++;
+  }
+  while (deque.pop(v)) taken[size_t(v)]++;
+  done = true;
+  for (auto& t : thieves) {
+    t.join();
+  }
+  for (intptr_t i = 0; i < kItems; i++) {
+    ASSERT_EQ(taken[size_t(i)], 1) << i;
+  }
+}
+
+TEST(TestThreadPool, PushFromOutside) {
+  ThreadPool pool("testpool", 4);
+  pool.Start();
+  std::atomic<int> count(0);
+  for (int i = 0; i < 10000; i++) {
+    pool.PushFunc([&count]() { count++; });
+  }
+  pool.WaitIdle();
+  EXPECT_EQ(count, 10000);
+  EXPECT_EQ(pool.GetThreadCount(), 4);
+  EXPECT_EQ(pool.GetWorkerIndex(), -1);
+}
+
+TEST(TestThreadPool, FanOutIsStolen) {
+  // One task spawns a burst of sub-tasks on its own worker; the other workers steal them
+  ThreadPool pool("fanout", 4);
+  pool.Start();
+  std::atomic<int> count(0);
+  std::mutex mutex;
+  std::set<int> workers;
+  pool.PushFunc([&]() {
+    for (int i = 0; i < 64; i++) {
+      pool.PushFunc([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::lock_guard lock(mutex);
+        workers.insert(pool.GetWorkerIndex());
+        count++;
+      });
+    }
+  });
+  pool.WaitIdle();
+  EXPECT_EQ(count, 64);
+  EXPECT_GT(workers.size(), 1);
+}
+
+TEST(TestThreadPool, TasksAndStop) {
+  std::atomic<int> count(0);
+  Task<void> task([&count](Task<void>*) { count += 10; });
+  {
+    ThreadPool pool("stop", 2);
+    // Tasks pushed before Start are kept in the injection queue
+    pool.Push(&task);
+    pool.PushFunc([&count](Task<void>* pTask) {
+      count++;
+      delete pTask;
+    });
+    pool.Start();
+    for (int i = 0; i < 100; i++) {
+      pool.PushFunc([&count]() { count++; });
+    }
+    // Stop runs every pushed task before joining
+  }
+  EXPECT_EQ(count, 111);
+}
+
+TEST(TestThreadPool, WaitIdleOnGlobalQuit) {
+  // The workers exit without running the task: WaitIdle() must not wait for it
+  int count = 0;
+  Task<void> task([&count](Task<void>*) { count++; });
+  ThreadPool pool("quit", 2);
+  TaskThread::SetGlobalQuit(true);
+  pool.Start();
+  pool.Push(&task);
+  pool.WaitIdle();
+  pool.Stop();
+  TaskThread::SetGlobalQuit(false);
+  EXPECT_EQ(count, 0);
+}
+
+TEST(TestThreadPool, PinnedWorkers) {
+  cpu_set_t allowed;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  ThreadOptions options;
+  for (int i = 0; i < CPU_SETSIZE; i++) {
+    if (CPU_ISSET(i, &allowed)) options.cpus.push_back(i);
+  }
+  options.bOneCpuPerThread = true;
+  ThreadPool pool("pinned", 3);
+  pool.SetThreadOptions(options);
+  pool.Start();
+
+  std::vector<int> cpus(pool.GetThreadCount(), -1);
+  std::atomic<int> nStarted(0);
+  for (size_t i = 0; i < pool.GetThreadCount(); i++) {
+    // Every worker records its own affinity once it is blocked here
+    pool.PushFunc([&]() {
+      cpu_set_t set;
+      pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+      int nCpu = -1;
+      if (CPU_COUNT(&set) == 1) {
+        while (!CPU_ISSET(++nCpu, &set)) {
+        }
+      }
+      cpus[size_t(pool.GetWorkerIndex())] = nCpu;
+      nStarted++;
+      while (nStarted < int(pool.GetThreadCount())) std::this_thread::yield();
+    });
+  }
+  pool.WaitIdle();
+  for (size_t i = 0; i < cpus.size(); i++) {
+    EXPECT_EQ(cpus[i], options.cpus[i % options.cpus.size()]);
+  }
+  pool.Stop();
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}